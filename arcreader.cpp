@@ -0,0 +1,225 @@
+#include "arcreader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+/* Yaz0 and RARC reading, formats as documented by yaz0dec/rarcdump (szstools)
+
+- AZ
+
+ */
+
+static uint16_t readBE16(const uint8_t* data) {
+    return static_cast<uint16_t>((data[0] << 8) | data[1]);
+}
+
+static uint32_t readBE32(const uint8_t* data) {
+    return (static_cast<uint32_t>(data[0]) << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+/*Yaz0*/
+
+bool isYaz0(const uint8_t* data, size_t size) {
+    return size >= 16 && std::memcmp(data, "Yaz0", 4) == 0;
+}
+
+/* Each group byte flags the next 8 chunks, MSB first: 1 is a literal byte, 0 a back-reference of
+2 bytes (length-2 in the top nibble, distance-1 in the other 12 bits) or 3 bytes when the top nibble
+is 0 (third byte is length-0x12). Output is sized up front from the header and written through raw
+pointers, all literal groups and non-overlapping references are plain block copies. */
+bool decompressYaz0(const uint8_t* data, size_t size, std::vector<uint8_t>& out, std::string& failure) {
+    if (!isYaz0(data, size)) {
+        failure = "Not Yaz0 compressed";
+        return false;
+    }
+
+    out.resize(readBE32(data + 4));
+    uint8_t* begin = out.data();
+    uint8_t* dst = begin;
+    uint8_t* dstEnd = begin + out.size();
+    const uint8_t* src = data + 16;
+    const uint8_t* srcEnd = data + size;
+
+    while (dst < dstEnd) {
+        if (src >= srcEnd) {
+            failure = "Yaz0 data ends early";
+            return false;
+        }
+        uint8_t group = *src++;
+
+        // Eight literals in a row, common in poorly compressible data
+        if (group == 0xFF && srcEnd - src >= 8 && dstEnd - dst >= 8) {
+            std::memcpy(dst, src, 8);
+            dst += 8;
+            src += 8;
+            continue;
+        }
+
+        for (int chunk = 0; chunk < 8 && dst < dstEnd; chunk++, group <<= 1) {
+            if (group & 0x80) {
+                if (src >= srcEnd) {
+                    failure = "Yaz0 data ends early";
+                    return false;
+                }
+                *dst++ = *src++;
+                continue;
+            }
+
+            if (srcEnd - src < 2) {
+                failure = "Yaz0 data ends early";
+                return false;
+            }
+            size_t distance = (((src[0] & 0x0F) << 8) | src[1]) + 1;
+            size_t length = src[0] >> 4;
+            src += 2;
+            if (length == 0) {
+                if (src >= srcEnd) {
+                    failure = "Yaz0 data ends early";
+                    return false;
+                }
+                length = *src++ + 0x12;
+            } else {
+                length += 2;
+            }
+
+            if (distance > static_cast<size_t>(dst - begin)) {
+                failure = "Yaz0 back-reference before the start of the data";
+                return false;
+            }
+            length = std::min(length, static_cast<size_t>(dstEnd - dst)); // Some encoders run over the end
+
+            const uint8_t* from = dst - distance;
+            if (distance >= length) {
+                std::memcpy(dst, from, length);
+            } else if (distance == 1) {
+                std::memset(dst, *from, length); // Run of one byte
+            } else {
+                // Overlapping, the copy reads bytes it just wrote
+                for (size_t i = 0; i < length; i++) {
+                    dst[i] = from[i];
+                }
+            }
+            dst += length;
+        }
+    }
+    return true;
+}
+
+/*RARC*/
+
+bool RarcArchive::open(const uint8_t* data, size_t size, std::string& failure) {
+    decompressed.clear();
+    decompressedFiles.clear();
+    entries.clear();
+
+    if (isYaz0(data, size)) {
+        if (!decompressYaz0(data, size, decompressed, failure)) {
+            return false;
+        }
+        data = decompressed.data();
+        size = decompressed.size();
+    }
+    return readTable(data, size, failure);
+}
+
+/* Header (0x20 bytes) then the info block, offsets in both are from the info block (0x20). Nodes are
+directories (0x10 bytes each) listing a run of entries (0x14 bytes each), an entry is a subdirectory
+(id 0xFFFF, data offset is its node index) or a file (data offset is from the start of the file data). */
+bool RarcArchive::readTable(const uint8_t* data, size_t size, std::string& failure) {
+    if (size < 0x40 || std::memcmp(data, "RARC", 4) != 0) {
+        failure = "Not a RARC archive";
+        return false;
+    }
+
+    const uint8_t* info = data + 0x20;
+    size_t fileDataStart = 0x20 + static_cast<size_t>(readBE32(data + 0x0C));
+    uint32_t nodeCount = readBE32(info + 0x00);
+    size_t nodeTable = 0x20 + static_cast<size_t>(readBE32(info + 0x04));
+    uint32_t entryCount = readBE32(info + 0x08);
+    size_t entryTable = 0x20 + static_cast<size_t>(readBE32(info + 0x0C));
+    size_t stringTableSize = readBE32(info + 0x10);
+    size_t stringTable = 0x20 + static_cast<size_t>(readBE32(info + 0x14));
+
+    if (nodeCount == 0 || nodeTable + static_cast<size_t>(nodeCount) * 0x10 > size ||
+        entryTable + static_cast<size_t>(entryCount) * 0x14 > size ||
+        stringTable + stringTableSize > size || fileDataStart > size) {
+        failure = "RARC file table is outside the archive";
+        return false;
+    }
+
+    auto readName = [&](size_t offset) {
+        if (offset >= stringTableSize) {
+            return std::string();
+        }
+        const char* name = reinterpret_cast<const char*>(data + stringTable + offset);
+        return std::string(name, strnlen(name, stringTableSize - offset));
+    };
+
+    // Walk the directories from the root node, each node only once in case the table loops
+    std::vector<bool> visitedNodes(nodeCount);
+    std::vector<std::pair<uint32_t, std::string>> pending = {{0, ""}};
+    visitedNodes[0] = true;
+
+    while (!pending.empty()) {
+        uint32_t node = pending.back().first;
+        std::string directory = std::move(pending.back().second);
+        pending.pop_back();
+
+        const uint8_t* nodeData = data + nodeTable + static_cast<size_t>(node) * 0x10;
+        uint16_t count = readBE16(nodeData + 0x0A);
+        uint32_t first = readBE32(nodeData + 0x0C);
+        if (static_cast<size_t>(first) + count > entryCount) {
+            failure = "RARC directory lists entries past the end of the table";
+            return false;
+        }
+
+        for (uint32_t i = first; i < first + count; i++) {
+            const uint8_t* entry = data + entryTable + static_cast<size_t>(i) * 0x14;
+            uint16_t id = readBE16(entry + 0x00);
+            uint8_t flags = entry[0x04];
+            std::string name = readName(readBE16(entry + 0x06));
+            if (name.empty() || name.find_first_of("/\\") != std::string::npos) {
+                continue; // Paths are built from the names, so they can't be allowed to leave the directory
+            }
+            uint32_t dataOffset = readBE32(entry + 0x08);
+            uint32_t dataSize = readBE32(entry + 0x0C);
+
+            if (id == 0xFFFF || (flags & 0x02)) {
+                if (name == "." || name == ".." || dataOffset >= nodeCount || visitedNodes[dataOffset]) {
+                    continue;
+                }
+                visitedNodes[dataOffset] = true;
+                pending.emplace_back(dataOffset, directory + name + "/");
+                continue;
+            }
+
+            if (fileDataStart + dataOffset + static_cast<size_t>(dataSize) > size) {
+                failure = "RARC file " + directory + name + " is outside the archive";
+                return false;
+            }
+
+            ArchiveFile file;
+            file.path = directory + name;
+            file.data = data + fileDataStart + dataOffset;
+            file.size = dataSize;
+
+            // Files can be compressed on their own too
+            if (isYaz0(file.data, file.size)) {
+                std::vector<uint8_t> contents;
+                if (!decompressYaz0(file.data, file.size, contents, failure)) {
+                    failure = file.path + ": " + failure;
+                    return false;
+                }
+                file.data = contents.data();
+                file.size = contents.size();
+                decompressedFiles.push_back(std::move(contents)); // The buffer moves with it, data stays valid
+            }
+            entries.push_back(std::move(file));
+        }
+    }
+
+    // Sorted by path, so the order doesn't depend on how the directories were walked
+    std::stable_sort(entries.begin(), entries.end(), [](const ArchiveFile& a, const ArchiveFile& b) { return a.path < b.path; });
+    return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Reads the game's .arc archives in memory: Yaz0 decompression and the RARC file table. Replaces
+running yaz0dec and rarcdump first, nothing is written to disk. */
+
+bool isYaz0(const uint8_t* data, size_t size);
+
+// Decompresses a whole Yaz0 stream into `out`, false with `failure` set when the stream is damaged
+bool decompressYaz0(const uint8_t* data, size_t size, std::vector<uint8_t>& out, std::string& failure);
+
+struct ArchiveFile {
+    std::string path;  // Path inside the archive, below the root directory ("bgm/title.bms")
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+};
+
+// A RARC archive, optionally Yaz0 compressed. The files point into the archive's own buffers
+// (or the caller's, for an uncompressed archive), so it has to outlive them.
+class RarcArchive {
+public:
+    bool open(const uint8_t* data, size_t size, std::string& failure);
+
+    const std::vector<ArchiveFile>& files() const {
+        return entries;
+    }
+
+private:
+    std::vector<uint8_t> decompressed;
+    std::vector<std::vector<uint8_t>> decompressedFiles; // Files stored Yaz0 compressed inside the archive
+    std::vector<ArchiveFile> entries;
+
+    bool readTable(const uint8_t* data, size_t size, std::string& failure);
+};
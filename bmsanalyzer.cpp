@@ -1,889 +1,1208 @@
-#include <iostream>
-#include <fstream>
-#include <vector>
-#include <cassert>
-#include <tuple>
-#include <iomanip> 
-#include <algorithm>
-#include <stack>
-#include <unordered_set>
-
-/* BMS to MIDI converter
+/* BMS to MIDI converter, command line front end of the conversion library (bmsconverter.cpp)
 
 - AZ
 
  */
 
-struct TrackEvent {
-    std::string event;
-    std::string description;
-};
-
-// Thanks XAYRGA for most track keys
-enum MML {
-    OPEN_TRACK          = 0xC1,
-    NOTE_TRACK          = 0xF9,
-    WAIT_8              = 0x80,
-    WAIT_16             = 0x88,
-    WAIT_VAR            = 0xF0,
-    CALL                = 0xC3,
-    RET                 = 0xC5,
-    JUMP                = 0xC7,
-    FIN                 = 0xFF,
-
-    J2_SET_PERF_8       = 0xB8,
-    J2_SET_PERF_16      = 0xB9,
-    J2_SET_ARTIC        = 0xD8,
-    J2_TEMPO            = 0xE0,
-    J2_SET_BANK         = 0xE2,
-    J2_SET_PROG         = 0xE3,
-    
-    /* Unused / Unimplemented
-    Many of these are subject to change from J2's audio system. 
-    Some are named their variables as they've been spotted, but unidentified*/
-    
-    // PARAM_SET           = 0xA0,
-    // ADDR                = 0xA1,
-    // MULR                = 0xA2,
-    // CMPR                = 0xA3,
-    // PARAM_SET_8         = 0xA4, 
-    // ADD8                = 0xA5,
-    // MUL8                = 0xA6,
-    // CMP8                = 0xA7,
-    // BITWISE             = 0xA9,
-    // LOADTBL             = 0xAA,
-    // SUB                 = 0xAB,
-    // PARAM_SET_16        = 0xAC,
-    // ADD16               = 0xAD,
-    // MUL16               = 0xAE,
-    // CMP16               = 0xAF,
-    // LOAD_TABLE          = 0xAA,
-    // SUBTRACT            = 0xAB,
-
-    // OSCILLATORFULL      = 0xF2,  
-    // FA                  = 0xFA, // 0
-    // PRINTF              = 0xFB,
-    // NAME_CHECK          = 0xFD,
-    // TEMPO               = 0xFE,
-
-    // INTERRUPT_TIMER     = 0xE4,
-    // SYNC_CPU            = 0xE7,
-    // WAIT_24             = 0xEA,
-    // EB                  = 0xEB, // 0
-    // PANSWSET            = 0xEF,
-
-    // NAME_BUS            = 0xD0, // 2
-    // D1                  = 0xD1, // 2
-    // D5                  = 0xD5, // 0
-    // ADSR                = 0xD8,
-    // D9                  = 0xD9, // 3
-    // DA                  = 0xDA, // 4
-    // DC                  = 0xDC, // 11
-    // BUS_CONNECT         = 0xDD,
-    // INTERRUPT           = 0xDF,
-
-    // OPEN_TRACK_BROS     = 0xC2,
-    // CALL_COND           = 0xC4, // 4
-    // RET_COND            = 0xC6, // 1
-    // JUMP_COND           = 0xC8, // 4
-    // LOOP_COUNT          = 0xC9,
-    // PORTREAD            = 0xCB,
-    // PORTWRITE           = 0xCC,
-    // SPECIALWAIT         = 0xCF,
-
-    // PERF_U8_NODUR       = 0x94,
-    // PERF_U8_DUR_U8      = 0x96,
-    // PERF_U8_DUR_U16     = 0x97,
-    // PERF_S8_NODUR       = 0x98,
-    // PERF_S8_DUR_U8      = 0x9A,
-    // PERF_S8_DUR_U16     = 0x9B,
-    // PERF_S16_NODUR      = 0x9C,
-    // PERF_S16_DUR_U8     = 0x9E,
-    // PERF_S16_DUR_U16    = 0x9F,
-
-};
-
-enum EffectType {
-    MML_VOLUME = 0,
-    MML_PITCH = 1,
-    MML_REVERB = 2,
-    MML_PAN = 3,
-    MML_EFFECT_UNKNOWN = 4
-};
+#include "bmsconverter.h"
+#include "workstealingpool.h"
+#include "arcreader.h"
+#include "sf2renderer.h"
+#include "sequencer.h"
+#include "bmsencoder.h"
 
-std::vector<std::tuple<uint8_t, uint8_t>> trackInstruments;
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <iomanip>
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <filesystem>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <limits>
+#include <atomic>
+#include <functional>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <iterator>
+#include <chrono>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*File Input*/
+
+// Read-only memory mapping of an input file
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        close();
+    }
 
-struct TrackParser {
-    std::vector<unsigned char> hexData;
-    uint32_t curOffset;
-    std::vector<TrackEvent> events;
+    bool open(const std::string& filename) {
+        close();
+#ifdef _WIN32
+        fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (fileHandle == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(fileHandle, &fileSize)) {
+            close();
+            return false;
+        }
+        length = static_cast<size_t>(fileSize.QuadPart);
+        if (length == 0) {
+            return true; // Nothing to map
+        }
+        mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mappingHandle == nullptr) {
+            close();
+            return false;
+        }
+        view = static_cast<const unsigned char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+#else
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) != 0) {
+            ::close(fd);
+            return false;
+        }
+        length = static_cast<size_t>(fileStat.st_size);
+        if (length == 0) {
+            ::close(fd);
+            return true; // Nothing to map
+        }
+        void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd); // The mapping keeps its own reference to the file
+        if (mapping == MAP_FAILED) {
+            length = 0;
+            return false;
+        }
+        madvise(mapping, length, MADV_SEQUENTIAL);
+        view = static_cast<const unsigned char*>(mapping);
+#endif
+        if (view == nullptr) {
+            close();
+            return false;
+        }
+        return true;
+    }
 
-    TrackParser() : curOffset(0) {}
+    void close() {
+#ifdef _WIN32
+        if (view != nullptr) {
+            UnmapViewOfFile(view);
+        }
+        if (mappingHandle != nullptr) {
+            CloseHandle(mappingHandle);
+        }
+        if (fileHandle != INVALID_HANDLE_VALUE) {
+            CloseHandle(fileHandle);
+        }
+        mappingHandle = nullptr;
+        fileHandle = INVALID_HANDLE_VALUE;
+#else
+        if (view != nullptr) {
+            munmap(const_cast<unsigned char*>(view), length);
+        }
+#endif
+        view = nullptr;
+        length = 0;
+    }
 
-    int16_t ppqn = 0x0078; // Pulses per Quarter Note (default 120)
-    int32_t tempo = 0x491803; // Tempo (default of 4790275 MPQN [microseconds per quarter note])
-    std::vector<std::tuple<uint8_t, uint32_t, uint32_t>> trackList; // TrackList [trackNo, trackStart, trackEnd]
+    const unsigned char* data() const {
+        return view;
+    }
 
-    uint8_t voiceToNote[8] = {}; // Array to remember the current note played by each voice ID
+    size_t size() const {
+        return length;
+    }
 
-    struct StackFrame {
-        uint32_t retOffset;
-    };
+private:
+    const unsigned char* view = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE fileHandle = INVALID_HANDLE_VALUE;
+    HANDLE mappingHandle = nullptr;
+#endif
+};
 
-    std::stack<StackFrame> callStack; // Call return positions
-
-    uint32_t VisitedAddressMax = 0;
-    std::unordered_set<uint32_t> VisitedAddresses;
-
-    uint32_t trackStartGlob = 0;
-
-    uint8_t trackNum = 0x00;
-
-    bool firstTrack = true;
-
-    /*Track Decoding*/
-    void parseEvents(uint32_t trackStart, uint32_t trackEnd) {
-
-        curOffset = trackStart;
-        trackStartGlob = trackStart;
-
-        while (curOffset != trackEnd) {
-            uint32_t beginOffset = curOffset;
-            uint8_t status_byte = hexData[curOffset++];
-
-            //std::cout << std::hex << static_cast<int>(status_byte) << std::endl;
-
-            if (status_byte < 0x80) {
-                // Note On Event
-                uint8_t note = status_byte;
-                uint8_t voice = hexData[curOffset++];
-                uint8_t velocity = hexData[curOffset++];
-
-                if (voice <= 0x01 && voice >= 0x08) {
-                        if (firstTrack) {
-                            firstTrackErrorHandling(status_byte);
-                            return;
-                        } else {
-                            std::cout << "! ERROR: A Note byte could not be read. !" << std::endl;
-                            std::cout << "Track Number: " << static_cast<int>(trackNum) << std::endl;
-                            std::cout << "Previous Byte: 0x" << std::hex << static_cast<int>(hexData[curOffset-2]) << std::endl;
-                            std::cout << "Status Byte: 0x" << std::hex << static_cast<int>(status_byte) << std::endl;
-                            std::cout << "Offset: 0x" << std::hex << static_cast<int>(curOffset) << std::endl;
-                            throw;
-                        }
-                };
-                voiceToNote[voice - 1] = note;
-                onEvent();
-                handleNoteOn(note, velocity);
-            } else if (status_byte == WAIT_8) {
-                uint8_t waitTime = hexData[curOffset++];
-                addTime(waitTime);    
-            } else if (status_byte < 0x88) {
-                // Note Off Event
-                uint8_t voice = status_byte & ~0x80;
-                onEvent();
-                handleNoteOff(voice);
-            } else {
-                // Other event handling
-                switch (status_byte) {
-                    case WAIT_16: {
-                        uint16_t waitTime = read16();
-                        addTime(waitTime);
-                        onEvent();
-                        break;
-                    }
-                    case WAIT_VAR: {
-                        uint32_t waitTime = convertFromVLQ();
-                        addTime(waitTime);
-                        onEvent();
-                        break;
-                    }
-                    case JUMP: {
-                        uint32_t jumpOffset = read24();
-
-                        // Check if the jump offset is beyond the current position
-                        if (isOffsetUsed(jumpOffset)) {
-                            onEvent();
-                            curOffset = jumpOffset;
-                        } else {
-                            // Jump offset points backward, create an infinite loop
-                            //std::cerr << "Warning: Infinite loop detected in jump. Skipping jump instruction." << std::endl;
-                        }
-                        
-                        break;
-                    }
-                    case CALL: {
-                        uint32_t callOffset = read24();
-                        onEvent();
-                        callStack.push({curOffset}); // Save the return address (next instruction after the call)
-                        curOffset = callOffset;
-                        break;
-                    }
-                    case RET: {
-                        if (!callStack.empty()) {
-                            onEvent();
-                            curOffset = callStack.top().retOffset;
-                            callStack.pop(); // Pop the return address from the call stack
-                        }
-                        break;
-                    }
-                    case J2_SET_BANK: {
-                        // Banks are setup with setProgram, the BMS versions are discarded.
-                        //uint8_t bank = hexData[curOffset++];
-                        curOffset += 1;
-                        onEvent();
-                        break;
-                    }
-                    case J2_SET_PROG: {
-                        uint8_t prog = hexData[curOffset++];
-                        onEvent();
-                        // Only run program if it isn't followed up by another program change
-                        if (hexData[curOffset] != J2_SET_PROG) {
-                            setProgram(prog);
-                        }
-                        break;
-                    }
-                    case J2_SET_PERF_8: {
-                        uint8_t type = hexData[curOffset++];
-                        int8_t value = static_cast<int8_t>(hexData[curOffset++]);
-                        setEffect(type,value);
-                        break;
-                    }
-                    case J2_SET_PERF_16: {
-                        uint8_t type = hexData[curOffset++];
-                        int16_t value = static_cast<int16_t>(read16());
-                        setEffect(type,value);
-                        break;
-                    }
-                    case NOTE_TRACK:
-                        curOffset += 2;
-                        onEvent();
-                        break;
-                    case FIN:
-                        onEvent();
-                        return;
-                    case J2_SET_ARTIC: {
-                        uint8_t type = hexData[curOffset++];
-                        if (type == 0x62) {
-                            uint16_t eventPPQN = read16();
-                            ppqn = eventPPQN;
-                        } else {
-                            curOffset += 2;
-                        }
-                        break;
-                    }
-                    case J2_TEMPO: {
-                        uint16_t bpm = read16();
-                        setTempo(bpm);
-                        onEvent();
-                        break;
-                    }
-                    case OPEN_TRACK: {
-                        curOffset += 4;
-                        break;
-                    }
+/*Conversion Cache*/
+
+/* On-disk cache for --cache <dir>. files/ holds finished .mid files keyed by a hash of the input bytes,
+the converter build and the options, a hit is linked (or copied) into place without decoding anything.
+tracks/ holds the library's per-track entries, so an edited sequence only decodes the tracks whose
+bytecode changed. Entries are written to a temporary name and renamed, so concurrent runs never see
+half of one. */
+class ConversionCache : public TrackCache {
+public:
+    bool reuseFiles = true; // Off when the run needs more than the .mid (instrument list, stats)
+
+    bool open(const std::string& directory) {
+        root = directory;
+        std::error_code ec;
+        std::filesystem::create_directories(root / "files", ec);
+        std::filesystem::create_directories(root / "tracks", ec);
+        return std::filesystem::is_directory(root / "files") && std::filesystem::is_directory(root / "tracks");
+    }
 
-                    /* Below this is thought to be used for ingame events (if boss stunned -> heroic_part) 
-                    No loss of quality has been seen in midi files due to their absence.
-                    Not fully working as of right now.
-                    */
-
-                    // case NAME_CHECK: {
-                    //     // Skip bytes until a 0x00 is encountered
-                    //     while (isValidOffset() && hexData[curOffset++] != 0x00) {std::cout << std::hex << hexData[curOffset-1] << std::endl;}
-                    //     // When one is encountered, keep skipping until the byte isn't 0x00
-                    //     while (isValidOffset() && hexData[curOffset] == 0x00) {
-                    //         curOffset++;
-                    //     }
-                    //     onEvent();
-                    //     break;
-                    // }
-                    // case EB:
-                    // case D5: {
-                    //     break;
-                    // }
-                    // case OPEN_TRACK_BROS:
-                    // case RET_COND: {
-                    //     curOffset += 1;
-                    //     break;
-                    // }
-                    // case NAME_BUS:
-                    // case D1: {
-                    //     curOffset += 2;
-                    //     break;
-                    // }
-                    // case D9: {
-                    //     curOffset += 3;
-                    //     break;
-                    // }
-                    // case CALL_COND:
-                    // case JUMP_COND: {
-                    //     curOffset += 4;
-                    //     break;
-                    // }
-                    // case FA: {
-                    //     curOffset += 5;
-                    //     break;
-                    // }
-                    // case DC: {
-                    //     curOffset += 11;
-                    //     break;
-                    // }
-                    // case DA: {
-                    //     while (isValidOffset()) {
-                    //         uint8_t value = hexData[curOffset];
-                    //         bool foundInEnum = false;
-
-                    //         // Check if the value matches any in the MML enum
-                    //         for (int i = OPEN_TRACK; i <= JUMP_COND; i++) {
-                    //             if (value == static_cast<uint8_t>(i)) {
-                    //                 foundInEnum = true;
-                    //                 break;
-                    //             }
-                    //         }
-
-                    //         if (foundInEnum) {
-                    //             // The value matches one in the MML enum, so we stop the loop
-                    //             break;
-                    //         }
-
-                    //         // If the value doesn't match, increment curOffset and continue the outer loop
-                    //         curOffset++;
-                    //     }
-                    //     break;
-                    // }
-
-                    default: {
-                        if (firstTrack) {
-                            firstTrackErrorHandling(status_byte);
-                            return;
-                        } else {
-                            std::cout << "! ERROR: A byte could not be read. !" << std::endl;
-                            std::cout << "Track Number: " << static_cast<int>(trackNum) << std::endl;
-                            std::cout << "Status Byte: 0x" << std::hex << static_cast<int>(status_byte) << std::endl;
-                            std::cout << "Previous Byte: 0x" << std::hex << static_cast<int>(hexData[curOffset -2]) << std::endl;
-                            std::cout << "Offset: 0x" << std::hex << static_cast<int>(curOffset) << std::endl;
-                            return;
-                        }
-                    }
-                }
-            }
+    bool load(const std::string& key, std::string& entry) override {
+        std::ifstream file(root / "tracks" / key, std::ios::binary);
+        if (!file) {
+            return false;
         }
+        std::ostringstream contents;
+        contents << file.rdbuf();
+        entry = contents.str();
+        return true;
     }
 
-    void setEffect(uint8_t type, double value) {
-        if (type == MML_VOLUME){
-            uint8_t midValue = value;
-            setVolume(midValue);
-        } else if (type == MML_PITCH){
-            uint16_t midValue = value;
-            setPitch(midValue);
-        }else if (type == MML_REVERB) {
-            uint8_t midValue = value;
-            setReverb(midValue);
-        } else if (type == MML_PAN) {
-            uint8_t midValue = value;
-            addPan(midValue);
-        } else if (type == MML_EFFECT_UNKNOWN) {
-            if (value != 0x00) {
-                std::cout << "Notice: Encountered an effect parameter of 0x04 that isn't a 0 byte; 0x" << std::hex << static_cast<int>(value) << std::endl;
+    void store(const std::string& key, const std::string& entry) override {
+        std::filesystem::path temporary = temporaryPath("tracks");
+        {
+            std::ofstream file(temporary, std::ios::binary);
+            file.write(entry.data(), entry.size());
+            if (!file) {
+                return;
             }
-        } else {
-            std::cout << "! ERROR: SetPerf found a unknown byte. !" << std::endl;
-            std::cout << "Track Number: " << static_cast<int>(trackNum) << std::endl;
-            std::cout << "Byte Type: 0x" << std::hex << static_cast<int>(type) << std::endl;
-            std::cout << "Value Byte: 0x" << std::hex << static_cast<int>(value) << std::endl;
-            std::cout << "Offset: 0x" << std::hex << static_cast<int>(curOffset) << std::endl;
         }
-        onEvent();
+        publish(temporary, root / "tracks" / key);
     }
 
-    void onEvent() {
-        if (trackStartGlob > VisitedAddressMax) {
-            VisitedAddressMax = trackStartGlob;
-        }
-        VisitedAddresses.insert(trackStartGlob);
+    // Where the finished .mid for this input and these options is kept
+    std::filesystem::path fileEntry(const uint8_t* data, size_t size, const ConversionOptions& options) const {
+        std::ostringstream settings;
+        settings << converterVersion() << ' ' << options.loopCount << ' ' << options.loopMarkers
+                 << ' ' << options.rangeStart << ' ' << options.rangeEnd
+                 << ' ' << static_cast<int>(options.minimumSeverity) << ' ' << options.diagnosticRepeats
+                 << ' ' << options.runningStatus << ' ' << options.noteOffsAsNoteOns << ' ' << options.dropRedundantEvents;
+        std::string text = settings.str();
+        uint64_t seed = hashBytes(reinterpret_cast<const uint8_t*>(text.data()), text.size());
+
+        std::ostringstream name;
+        name << std::hex << std::setfill('0') << std::setw(16) << hashBytes(data, size, seed)
+             << std::setw(16) << hashBytes(data, size, ~seed) << ".mid";
+        return root / "files" / name.str();
     }
 
-    bool isOffsetUsed(uint32_t offset) {
-        if (curOffset <= VisitedAddressMax) {
-            auto itrOffset = VisitedAddresses.find(curOffset);
-            if (itrOffset != VisitedAddresses.end()) {
-                return true;
-            }
+    // Puts a cached .mid at `midiFilename`, false when there's nothing cached
+    bool restoreFile(const std::filesystem::path& entry, const std::string& midiFilename) const {
+        std::error_code ec;
+        if (!std::filesystem::is_regular_file(entry, ec)) {
+            return false;
         }
-        return false;
+        std::filesystem::remove(midiFilename, ec);
+        std::filesystem::create_hard_link(entry, midiFilename, ec);
+        if (ec) {
+            ec.clear();
+            std::filesystem::copy_file(entry, midiFilename, std::filesystem::copy_options::overwrite_existing, ec);
+        }
+        return !ec;
     }
 
-    uint32_t convertFromVLQ() {
-        // Reads it as VLQ (Variable-length quantity), so following calculations can work with correct values
-        register uint32_t value;
-        register uint8_t c;
-
-        if (isValidOffset() && (value = hexData[curOffset++]) & 0x80) {
-            value &= 0x7F;
-            do {
-            if (!isValidOffset())
-                break;
-            value = (value << 7) + ((c = hexData[curOffset++]) & 0x7F);
-            } while (c & 0x80);
+    void storeFile(const std::string& midiFilename, const std::filesystem::path& entry) {
+        std::filesystem::path temporary = temporaryPath("files");
+        std::error_code ec;
+        std::filesystem::create_hard_link(midiFilename, temporary, ec);
+        if (ec) {
+            ec.clear();
+            std::filesystem::copy_file(midiFilename, temporary, ec);
+        }
+        if (!ec) {
+            publish(temporary, entry);
         }
-        return value;
     }
 
-    std::vector<uint8_t> convertToVLQ(uint32_t input) {
-        // Conversion back to VLQ (used for MIDI)
-        std::vector<uint8_t> buf;
-        uint32_t buffer = input & 0x7F;
+private:
+    std::filesystem::path root;
+    std::atomic<uint64_t> temporaryCount{0};
 
-        input >>= 7;
-
-        while (input > 0) {
-            buffer <<= 8;
-            buffer |= ((input & 0x7F) | 0x80);
-            input >>= 7;
-        }
+    std::filesystem::path temporaryPath(const char* folder) {
+        std::ostringstream name;
+        name << "." << std::hash<std::thread::id>()(std::this_thread::get_id()) << "-" << temporaryCount++ << ".tmp";
+        return root / folder / name.str();
+    }
 
-        while (true) {
-            buf.push_back(static_cast<uint8_t>(buffer));
-            if (buffer & 0x80)
-                buffer >>= 8;
-            else
-                break;
+    static void publish(const std::filesystem::path& temporary, const std::filesystem::path& entry) {
+        std::error_code ec;
+        std::filesystem::rename(temporary, entry, ec);
+        if (ec) {
+            std::filesystem::remove(temporary, ec);
         }
-        return buf;
     }
+};
 
-    bool isValidOffset() {
-        return (curOffset < hexData.size());
-    }
+/*Stats*/
 
-    uint16_t read16() {
-        if (curOffset + 1 >= hexData.size()) {
-            throw std::out_of_range("Offset is out of bounds");
+std::string jsonString(const std::string& text) {
+    std::ostringstream out;
+    out << '"';
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (c < 0x20) {
+            out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec;
+        } else {
+            out << c;
         }
-        uint16_t value = (static_cast<uint16_t>(hexData[curOffset]) << 8) | static_cast<uint16_t>(hexData[curOffset + 1]);
-        curOffset += 2;
-        return value;
     }
+    out << '"';
+    return out.str();
+}
 
-    uint32_t read24() {
-        if (curOffset + 2 >= hexData.size()) {
-            throw std::out_of_range("Offset is out of bounds");
+void writeOpcodeCounts(std::ostream& out, const std::array<uint64_t, 256>& counts, const std::string& indent) {
+    out << "{";
+    const char* separator = "";
+    for (size_t op = 0; op < counts.size(); op++) {
+        if (counts[op] > 0) {
+            out << separator << "\n" << indent << "  \"0x" << std::hex << std::setw(2) << std::setfill('0') << op << std::dec
+                << "\": {\"name\": " << jsonString(opcodeName(static_cast<uint8_t>(op))) << ", \"count\": " << counts[op] << "}";
+            separator = ",";
         }
+    }
+    out << "\n" << indent << "}";
+}
+
+void writeTimings(std::ostream& out, const ConversionTimings& timings) {
+    out << "{\"trackScan\": " << timings.trackPointers << ", \"decode\": " << timings.decode
+        << ", \"midiFinalization\": " << timings.midi << "}";
+}
+
+void writeFileStats(std::ostream& out, const std::string& filename, const ConversionResult& result, const std::string& indent) {
+    uint64_t instructions = 0;
+    for (const auto& track : result.stats.tracks) {
+        instructions += track.instructions;
+    }
 
-        uint32_t value = (static_cast<uint32_t>(hexData[curOffset]) << 16) |
-                         (static_cast<uint32_t>(hexData[curOffset + 1]) << 8) |
-                         static_cast<uint32_t>(hexData[curOffset + 2]);
-        curOffset += 3;
-        return value;
+    out << indent << "{\n";
+    out << indent << "  \"file\": " << jsonString(filename) << ",\n";
+    out << indent << "  \"ok\": " << (result.ok ? "true" : "false") << ",\n";
+    if (!result.ok) {
+        out << indent << "  \"failure\": " << jsonString(result.failure) << ",\n";
     }
+    out << indent << "  \"inputBytes\": " << result.inputBytes << ",\n";
+    out << indent << "  \"midiBytes\": " << result.midiBytes << ",\n";
+    out << indent << "  \"instructions\": " << instructions << ",\n";
+    out << indent << "  \"events\": " << result.eventCount << ",\n";
+    out << indent << "  \"decodeErrors\": " << result.errorCount << ",\n";
+    out << indent << "  \"seconds\": ";
+    writeTimings(out, result.timings);
+    out << ",\n";
+    out << indent << "  \"tracks\": [";
+    for (size_t i = 0; i < result.stats.tracks.size(); i++) {
+        const TrackStats& track = result.stats.tracks[i];
+        out << (i > 0 ? "," : "") << "\n" << indent << "    {\"track\": " << static_cast<int>(track.trackNum)
+            << ", \"instructions\": " << track.instructions << ", \"events\": " << track.events
+            << ", \"midiBytes\": " << track.midiBytes << "}";
+    }
+    out << "\n" << indent << "  ],\n";
+    out << indent << "  \"opcodes\": ";
+    writeOpcodeCounts(out, result.stats.opcodeCounts, indent + "  ");
+    out << "\n" << indent << "}";
+}
 
-    uint32_t getWord(uint32_t nIndex) {
-        assert((nIndex >= 0) && (nIndex + 4 <= hexData.size()));
-        return ((static_cast<uint32_t>(hexData[nIndex]) << 24) +
-                (static_cast<uint32_t>(hexData[nIndex + 1]) << 16) +
-                (static_cast<uint32_t>(hexData[nIndex + 2]) << 8) +
-                static_cast<uint32_t>(hexData[nIndex + 3]));
+// A single file is written as its own object, a batch as the files plus corpus totals
+bool writeStatsFile(const std::string& statsFile, const std::vector<std::string>& files, const std::vector<ConversionResult>& results) {
+    std::ofstream out(statsFile);
+    if (!out) {
+        std::cerr << "Failed to create stats file: " << statsFile << std::endl;
+        return false;
     }
+    out << std::setprecision(9);
 
-    bool addedStartingTrackStart = false;
+    if (files.size() == 1) {
+        writeFileStats(out, files[0], results[0], "");
+        out << std::endl;
+        return static_cast<bool>(out);
+    }
 
-    void scanForTracks(uint32_t offset) {
-        if (!addedStartingTrackStart) {
-            trackList.push_back(std::make_tuple(0, 0, 0));
-            addedStartingTrackStart = true;
-        }
-        while (hexData[offset] == OPEN_TRACK) {
-            uint8_t trackNo = hexData[offset + 1];
-            uint32_t trackStart = getWord(offset + 1) & 0x00FFFFFF;
-            scanForTracks(trackStart);
-            trackList.push_back(std::make_tuple(trackNo + 1, trackStart, 0));
-            offset += 0x05;
+    ConversionResult totals;
+    size_t converted = 0;
+    for (const auto& result : results) {
+        converted += result.ok ? 1 : 0;
+        totals.inputBytes += result.inputBytes;
+        totals.midiBytes += result.midiBytes;
+        totals.eventCount += result.eventCount;
+        totals.errorCount += result.errorCount;
+        totals.timings.trackPointers += result.timings.trackPointers;
+        totals.timings.decode += result.timings.decode;
+        totals.timings.midi += result.timings.midi;
+        for (size_t op = 0; op < totals.stats.opcodeCounts.size(); op++) {
+            totals.stats.opcodeCounts[op] += result.stats.opcodeCounts[op];
         }
     }
+    double decodeSeconds = std::max(totals.timings.decode, 1e-9);
 
-    void getTrackPointers() {
-        scanForTracks(0);
+    out << "{\n  \"files\": [\n";
+    for (size_t i = 0; i < files.size(); i++) {
+        writeFileStats(out, files[i], results[i], "    ");
+        out << (i + 1 < files.size() ? ",\n" : "\n");
+    }
+    out << "  ],\n";
+    out << "  \"totals\": {\n";
+    out << "    \"files\": " << files.size() << ",\n";
+    out << "    \"converted\": " << converted << ",\n";
+    out << "    \"inputBytes\": " << totals.inputBytes << ",\n";
+    out << "    \"midiBytes\": " << totals.midiBytes << ",\n";
+    out << "    \"events\": " << totals.eventCount << ",\n";
+    out << "    \"decodeErrors\": " << totals.errorCount << ",\n";
+    out << "    \"seconds\": ";
+    writeTimings(out, totals.timings);
+    out << ",\n";
+    out << "    \"decodeMBPerSecond\": " << totals.inputBytes / 1e6 / decodeSeconds << ",\n";
+    out << "    \"decodeEventsPerSecond\": " << totals.eventCount / decodeSeconds << ",\n";
+    out << "    \"opcodes\": ";
+    writeOpcodeCounts(out, totals.stats.opcodeCounts, "    ");
+    out << "\n  }\n}" << std::endl;
+    return static_cast<bool>(out);
+}
 
-        if (trackList.empty()) {
-            return;
-        }
+/*Seek Index*/
 
-        // Set the first track's end to the "last track" (2nd),
-        std::get<2>(trackList.front()) = std::get<1>(trackList.back());
-        // Remove the "last track" (scanned along with first track)
-        trackList.pop_back(); 
+/* Ranges are converted with the file's seek index, kept as <file>.index next to it. It's rebuilt (one
+full conversion) when it's missing or was made from other bytes or by another build. */
+bool loadSeekIndex(const std::string& filename, SeekIndex& index) {
+    MappedFile inputFile;
+    if (!inputFile.open(filename)) {
+        std::cerr << "Failed to open file: " << filename << std::endl;
+        return false;
+    }
 
-        for (size_t i = 1; i < trackList.size(); i++) {
-            uint32_t nextTrackStart;
-            if (i < trackList.size() - 1) {
-                nextTrackStart = std::get<1>(trackList[i + 1]);
-            } else {
-                nextTrackStart = hexData.size();
-            }
-            std::get<2>(trackList[i]) = nextTrackStart;
+    std::string indexFilename = filename + ".index";
+    std::ifstream indexFile(indexFilename, std::ios::binary);
+    if (indexFile) {
+        std::string data((std::istreambuf_iterator<char>(indexFile)), std::istreambuf_iterator<char>());
+        if (index.deserialize(data) && index.matches(inputFile.data(), inputFile.size())) {
+            return true;
         }
     }
 
-    void firstTrackErrorHandling(uint8_t status_byte) {
-            std::cout << "Notice: A byte could not be read on the inital track." << std::endl;
-            std::cout << "File will still be converted, inital track bytes is yet to be deciphered." << std::endl;
-            std::cout << "Status Byte: 0x" << std::hex << static_cast<int>(status_byte) << std::endl;
-            std::cout << "Offset: 0x" << std::hex << static_cast<int>(curOffset) << std::endl;
+    ConversionOptions options;
+    options.buildSeekIndex = true;
+    ConversionResult result = convertBMS(inputFile.data(), inputFile.size(), options);
+    if (!result.ok) {
+        std::cerr << "Failed to index " << filename << ": " << result.failure << std::endl;
+        return false;
+    }
+    index = std::move(result.seekIndex);
+
+    // Only saves the next run the indexing, a read-only directory isn't an error
+    std::string data = index.serialize();
+    std::string temporary = indexFilename + ".tmp";
+    std::ofstream output(temporary, std::ios::binary);
+    output.write(data.data(), data.size());
+    output.close();
+    std::error_code ec;
+    if (output) {
+        std::filesystem::rename(temporary, indexFilename, ec);
+    } else {
+        std::filesystem::remove(temporary, ec);
     }
+    return true;
+}
 
-    /*Midi Creation*/
+// --range start:end in seconds, either end can be left out ("180:" is from 3:00 on)
+bool applyRange(const std::string& filename, const std::string& range, SeekIndex& index, ConversionOptions& options) {
+    size_t colon = range.find(':');
+    if (colon == std::string::npos) {
+        std::cerr << "Invalid range, expected start:end in seconds: " << range << std::endl;
+        return false;
+    }
+    double start = 0;
+    double end = -1;
+    try {
+        if (colon > 0) {
+            start = std::stod(range.substr(0, colon));
+        }
+        if (colon + 1 < range.size()) {
+            end = std::stod(range.substr(colon + 1));
+        }
+    } catch (const std::exception&) {
+        std::cerr << "Invalid range, expected start:end in seconds: " << range << std::endl;
+        return false;
+    }
+    if (start < 0 || (end >= 0 && end <= start)) {
+        std::cerr << "Invalid range: " << range << std::endl;
+        return false;
+    }
 
-    std::ofstream outputFile;
-    std::vector<unsigned char> midiData;
-    uint32_t accumulatedWaitTime = 0;
-    uint32_t previousEventTimestamp = 0;
+    if (!loadSeekIndex(filename, index)) {
+        return false;
+    }
+    options.seekIndex = &index;
+    options.rangeStart = index.tickAt(static_cast<uint64_t>(start * 1e6));
+    options.rangeEnd = (end < 0) ? UINT32_MAX : index.tickAt(static_cast<uint64_t>(end * 1e6));
+    return true;
+}
 
-    std::vector<std::tuple<uint8_t, uint8_t>> midiMappings;
-    int currentMidiMapping;
-    uint8_t statusNum = 0x00;
+/*Batch Conversion*/
+
+// Command line settings shared by every file of a run
+struct CommandLineOptions {
+    ConversionOptions conversion;
+    bool parallelTracks = false; // conversion.trackPool is pointed at the run's pool
+    std::string statsFile;       // Write conversion stats here as JSON, turns on conversion.collectStats
+    ConversionCache* cache = nullptr; // --cache, also set as conversion.trackCache
+    const SoundFont* soundFont = nullptr; // --render, also writes a .wav next to every .mid
+    RenderOptions render;                 // render.pool is pointed at the run's pool
+    std::string disassembly;              // --disasm text|json, writes a .disasm.txt/.disasm.jsonl next to every .mid
+};
 
-    void writeMIDIData(const std::vector<unsigned char>& eventData) {
-        midiData.insert(midiData.end(), eventData.begin(), eventData.end());
+// Renders a converted sequence to `wavFilename`, a failed render fails the whole conversion
+void renderFile(ConversionResult& result, const std::string& wavFilename, const CommandLineOptions& options, RenderResult* rendered) {
+    std::error_code removeError;
+    std::filesystem::remove(wavFilename, removeError);
+    std::ofstream wavFile(wavFilename, std::ios::binary);
+    if (!wavFile) {
+        result.ok = false;
+        result.failure = "Failed to create WAV file: " + wavFilename;
+        return;
     }
 
-    void writeMIDIData(const std::vector<unsigned char>& eventData, std::size_t position) {
-        midiData.insert(midiData.begin() + position, eventData.begin(), eventData.end());
+    RenderResult render = renderWAV(result.events, result.ppqn, *options.soundFont, options.render, wavFile);
+    std::vector<EventStream>().swap(result.events); // Only needed for the render
+    result.diagnostics += render.diagnostics;
+    if (!render.ok) {
+        wavFile.close();
+        std::filesystem::remove(wavFilename, removeError);
+        result.ok = false;
+        result.failure = render.failure;
     }
-
-    void finalizeMIDIFile() {
-        outputFile.write(reinterpret_cast<const char*>(midiData.data()), midiData.size());
+    if (rendered != nullptr) {
+        *rendered = std::move(render);
     }
+}
 
-    size_t trackStartMarker = 0;
-    
-    void handleTrackPoints() {
-        // Write the track end
-        std::vector<unsigned char> trackEnd = {0x00, 0xFF, 0x2F, 0x00};
-        writeMIDIData(trackEnd);
-
-        // MIDI track header (length accounts for track end)
-        std::vector<unsigned char> trackHeader = {
-            'M', 'T', 'r', 'k',
-            static_cast<unsigned char>((midiData.size() - trackStartMarker) >> 24 & 0xFF),
-            static_cast<unsigned char>((midiData.size() - trackStartMarker) >> 16 & 0xFF),
-            static_cast<unsigned char>((midiData.size() - trackStartMarker) >> 8 & 0xFF),
-            static_cast<unsigned char>((midiData.size() - trackStartMarker) & 0xFF),
-        };
-
-        writeMIDIData(trackHeader, trackStartMarker);
+// Converts BMS bytes already in memory (a mapped file or an archive entry) to `midiFilename`
+ConversionResult convertBuffer(const uint8_t* data, size_t size, const std::string& midiFilename,
+                               const CommandLineOptions& commandLine, RenderResult* rendered = nullptr) {
+    ConversionOptions options = commandLine.conversion;
+    ConversionCache* cache = commandLine.cache;
+    ConversionResult result;
+    std::string baseFilename = midiFilename.substr(0, midiFilename.find_last_of('.'));
+
+    std::filesystem::path cacheEntry;
+    if (cache != nullptr && cache->reuseFiles) {
+        cacheEntry = cache->fileEntry(data, size, options);
+        if (cache->restoreFile(cacheEntry, midiFilename)) {
+            // Only clean conversions are cached, so the header's track count is all there is to report
+            std::ifstream midiFile(midiFilename, std::ios::binary);
+            uint8_t header[12] = {};
+            midiFile.read(reinterpret_cast<char*>(header), sizeof(header));
+            result.ok = true;
+            result.inputBytes = size;
+            result.trackCount = (header[10] << 8) | header[11];
+            result.cachedTracks = result.trackCount;
+            result.midiBytes = static_cast<size_t>(std::filesystem::file_size(midiFilename));
+            return result;
+        }
     }
 
-    void handleMIDIHeader() {
-        std::vector<unsigned char> header = {
-            'M', 'T', 'h', 'd', 0x00, 0x00, 0x00, 0x06, 0x00, 0x01, 0x00, static_cast<unsigned char>(trackList.size())
-        };
+    std::ofstream disassemblyFile;
+    if (!commandLine.disassembly.empty()) {
+        bool json = commandLine.disassembly == "json";
+        std::string disassemblyFilename = baseFilename + (json ? ".disasm.jsonl" : ".disasm.txt");
+        disassemblyFile.open(disassemblyFilename, std::ios::binary);
+        if (!disassemblyFile) {
+            result.failure = "Failed to create disassembly file: " + disassemblyFilename;
+            return result;
+        }
+        options.disassembly = &disassemblyFile;
+        options.disassemblyJSON = json;
+    }
 
-        unsigned char* ppqnBytes = reinterpret_cast<unsigned char*>(&ppqn);
+    // Replaced rather than overwritten, the old file may be hard linked into a --cache
+    std::error_code removeError;
+    std::filesystem::remove(midiFilename, removeError);
+    std::ofstream outputFile(midiFilename, std::ios::binary);
+    if (!outputFile) {
+        result.failure = "Failed to create MIDI file: " + midiFilename;
+        return result;
+    }
 
-        header.push_back(ppqnBytes[1]);
-        header.push_back(ppqnBytes[0]);
+    result = convertBMS(data, size, options, outputFile);
+    if (result.ok && disassemblyFile.is_open() && !disassemblyFile.flush()) {
+        result.ok = false;
+        result.failure = "Failed to write the disassembly file";
+    }
+    if (!result.ok) {
+        // Don't leave a half written file behind
+        outputFile.close();
+        std::error_code ec;
+        std::filesystem::remove(midiFilename, ec);
+    } else if (!cacheEntry.empty() && result.errorCount == 0 && result.diagnostics.empty()) {
+        outputFile.close();
+        cache->storeFile(midiFilename, cacheEntry);
+    }
 
-        writeMIDIData(header, 0);
+    if (result.ok && commandLine.soundFont != nullptr) {
+        renderFile(result, baseFilename + ".wav", commandLine, rendered);
     }
+    return result;
+}
 
-    std::vector<uint8_t> calculateDeltaTime() {
-        uint32_t deltaTime = accumulatedWaitTime - previousEventTimestamp;
-        previousEventTimestamp = accumulatedWaitTime; // Update timestamp
-        return convertToVLQ(deltaTime);
+// Converts a .bms file to a .mid next to it, the result says why when it couldn't be converted
+ConversionResult convertFile(const std::string& filename, const CommandLineOptions& options, RenderResult* rendered = nullptr) {
+    MappedFile inputFile;
+    if (!inputFile.open(filename)) {
+        ConversionResult result;
+        result.failure = "Failed to open file: " + filename;
+        return result;
     }
 
-    void setProgram(uint8_t program) {
-        uint8_t bank = program / 128;
-        uint8_t actualProgram = program - 128 * bank;
-        bank += 0x16;
+    std::string midiFilename = filename.substr(0, filename.find_last_of('.')) + ".mid";
+    return convertBuffer(inputFile.data(), inputFile.size(), midiFilename, options, rendered);
+}
 
-        // Assumed that program select is always first in the track
-        // Check if the MIDI mapping already exists in the list
-        bool mappingExists = false;
-        uint8_t existingStatusNum = 0x00;
+// A batch source is either a directory of .bms files or a text file listing one path per line
+std::vector<std::string> collectBatchFiles(const std::string& source) {
+    std::vector<std::string> files;
 
-        for (const auto& mapping : midiMappings) {
-            if (std::get<1>(mapping) == program) {
-                mappingExists = true;
-                existingStatusNum = std::get<0>(mapping);
-                break;
+    if (std::filesystem::is_directory(source)) {
+        for (const auto& entry : std::filesystem::directory_iterator(source)) {
+            if (entry.is_regular_file() && entry.path().extension() == ".bms") {
+                files.push_back(entry.path().string());
             }
         }
+    } else {
+        std::ifstream listFile(source);
+        std::string line;
+        while (std::getline(listFile, line)) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (!line.empty()) {
+                files.push_back(line);
+            }
+        }
+    }
 
-        if (!mappingExists) {
-            // Determine the new statusNum based on the last statusNum in the vector
-            uint8_t newStatusNum = midiMappings.empty() ? 0x00 : (std::get<0>(midiMappings.back()) + 1);
-
-            // Add the MIDI mapping to the global list
-            midiMappings.push_back(std::make_tuple(newStatusNum, program));
+    // Largest sequences first, so a big file doesn't start last and hold up the whole batch
+    std::vector<std::pair<uintmax_t, std::string>> sized;
+    for (const auto& file : files) {
+        std::error_code ec;
+        uintmax_t size = std::filesystem::file_size(file, ec);
+        sized.emplace_back(ec ? 0 : size, file);
+    }
+    std::stable_sort(sized.begin(), sized.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
 
-            // Use the newly determined statusNum
-            statusNum = newStatusNum;
-        } else {
-            // Use the existing statusNum from the list
-            statusNum = existingStatusNum;
-        }
+    files.clear();
+    for (const auto& entry : sized) {
+        files.push_back(entry.second);
+    }
+    return files;
+}
 
-        if (statusNum >= 0x10) {
-            std::cout << "! ERROR: Status Num exceeded 16 !" << std::endl;
+// Runs convert(i, options) for every name across the pool and reports each one plus a summary
+int runConversions(const std::vector<std::string>& files, unsigned jobs, const CommandLineOptions& options,
+                   const std::function<ConversionResult(size_t, const CommandLineOptions&)>& convert) {
+    std::mutex reportMutex;
+    size_t converted = 0;
+    size_t withErrors = 0;
+    std::vector<std::string> failures;
+    std::vector<ConversionResult> results(options.statsFile.empty() ? 0 : files.size());
+
+    {
+        WorkStealingPool pool(jobs);
+        CommandLineOptions jobOptions = options;
+        jobOptions.conversion.trackPool = options.parallelTracks ? &pool : nullptr;
+        jobOptions.render.pool = &pool;
+
+        for (size_t i = 0; i < files.size(); i++) {
+            pool.submit([&, i] {
+                const std::string& file = files[i];
+                ConversionResult result = convert(i, jobOptions);
+
+                std::lock_guard<std::mutex> lock(reportMutex);
+                if (result.ok) {
+                    converted++;
+                    std::cout << "OK    " << file << " (" << std::dec << result.trackCount << " tracks";
+                    if (result.errorCount > 0) {
+                        withErrors++;
+                        std::cout << ", " << result.errorCount << " decode errors";
+                    }
+                    if (result.cachedTracks > 0) {
+                        std::cout << ", " << result.cachedTracks << " cached";
+                    }
+                    std::cout << ")" << std::endl;
+                } else {
+                    failures.push_back(file + ": " + result.failure);
+                    std::cout << "FAIL  " << file << ": " << result.failure << std::endl;
+                }
+                // The diagnostics are only worth showing when something went wrong
+                if (!result.ok || result.errorCount > 0) {
+                    std::cout << result.diagnostics;
+                }
+                if (!options.statsFile.empty()) {
+                    result.diagnostics.clear();
+                    results[i] = std::move(result);
+                }
+            });
         }
+        pool.wait();
+    }
 
-        trackInstruments.push_back(std::make_tuple(trackNum, program));
-
-        // MIDI bank select event
-        std::vector<unsigned char> bankSelectEvent = calculateDeltaTime();
-        bankSelectEvent.push_back(0xB0 + statusNum);
-        bankSelectEvent.push_back(0x00);
-        bankSelectEvent.push_back(bank);
+    std::cout << std::dec << std::endl;
+    std::cout << "Batch summary: " << files.size() << " files, " << converted << " converted, "
+              << failures.size() << " failed, " << withErrors << " with decode errors" << std::endl;
+    for (const auto& failure : failures) {
+        std::cout << "  " << failure << std::endl;
+    }
 
-        // MIDI program change event
-        std::vector<unsigned char> programChangeEvent = calculateDeltaTime();
-        programChangeEvent.push_back(0xC0 + statusNum);
-        programChangeEvent.push_back(actualProgram);
+    if (!options.statsFile.empty() && !writeStatsFile(options.statsFile, files, results)) {
+        return 1;
+    }
+    return failures.empty() ? 0 : 1;
+}
 
-        writeMIDIData(bankSelectEvent);
-        writeMIDIData(programChangeEvent);
+int runBatch(const std::string& source, unsigned jobs, const CommandLineOptions& options) {
+    std::vector<std::string> files = collectBatchFiles(source);
+    if (files.empty()) {
+        std::cerr << "No .bms files found in: " << source << std::endl;
+        return 1;
     }
 
-    void handleNoteOn(uint8_t note, uint8_t velocity) {
+    return runConversions(files, jobs, options, [&](size_t i, const CommandLineOptions& jobOptions) {
+        return convertFile(files[i], jobOptions);
+    });
+}
 
-        // Create MIDI note-on event
-        uint8_t statusByte = 0x90 + statusNum;
+/*Archives*/
 
-        // Create the MIDI note-on event data
-        std::vector<unsigned char> eventData = calculateDeltaTime();  // Delta time
-        eventData.push_back(statusByte);
-        eventData.push_back(note);
-        eventData.push_back(velocity);
+// Archives are recognized by content, they're usually .arc but the extension isn't reliable
+bool isArchive(const std::string& filename) {
+    char magic[4] = {};
+    std::ifstream file(filename, std::ios::binary);
+    file.read(magic, sizeof(magic));
+    return file && (std::memcmp(magic, "Yaz0", 4) == 0 || std::memcmp(magic, "RARC", 4) == 0);
+}
 
-        writeMIDIData(eventData);
+/* Converts every .bms in a (Yaz0 compressed) RARC archive straight from memory, the .mid files go in a
+folder named after the archive, keeping the archive's directories. */
+int runArchive(const std::string& filename, unsigned jobs, const CommandLineOptions& options) {
+    MappedFile inputFile;
+    if (!inputFile.open(filename)) {
+        std::cerr << "Failed to open file: " << filename << std::endl;
+        return 1;
     }
 
-    void handleNoteOff(uint8_t voice) {
+    RarcArchive archive;
+    std::string failure;
+    if (!archive.open(inputFile.data(), inputFile.size(), failure)) {
+        std::cerr << filename << ": " << failure << std::endl;
+        return 1;
+    }
 
-        // Validate voice ID
-        if (voice > 0 && voice <= 8) {
-            // Retrieve the note being played by the specified voice
-            uint8_t note = voiceToNote[voice-1];
+    std::vector<const ArchiveFile*> sequences;
+    for (const auto& file : archive.files()) {
+        std::string extension = std::filesystem::path(file.path).extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+        if (extension == ".bms") {
+            sequences.push_back(&file);
+        }
+    }
+    if (sequences.empty()) {
+        std::cerr << "No .bms files found in: " << filename << std::endl;
+        return 1;
+    }
 
-            // Reset the voice ID to indicate it's available
-            voiceToNote[voice-1] = 0;
+    // Largest sequences first, like a batch
+    std::stable_sort(sequences.begin(), sequences.end(), [](const ArchiveFile* a, const ArchiveFile* b) { return a->size > b->size; });
+
+    std::filesystem::path outputFolder = std::filesystem::path(filename).replace_extension();
+    std::vector<std::string> names;
+    std::vector<std::string> midiFilenames;
+    for (const ArchiveFile* sequence : sequences) {
+        std::filesystem::path midiPath = (outputFolder / sequence->path).replace_extension(".mid");
+        std::error_code ec;
+        std::filesystem::create_directories(midiPath.parent_path(), ec);
+        names.push_back(filename + ":" + sequence->path);
+        midiFilenames.push_back(midiPath.string());
+    }
 
-            // Create MIDI note-off event
-            uint8_t statusByte = 0x80 + statusNum;
+    return runConversions(names, jobs, options, [&](size_t i, const CommandLineOptions& jobOptions) {
+        return convertBuffer(sequences[i]->data, sequences[i]->size, midiFilenames[i], jobOptions);
+    });
+}
 
-            // Create the MIDI note-off event data
-            std::vector<unsigned char> eventData = calculateDeltaTime();  // Delta time
-            eventData.push_back(statusByte);
-            eventData.push_back(note);
-            eventData.push_back(0x40);  // Velocity is set to 0 for note-off
+/*Benchmark*/
 
-            writeMIDIData(eventData);
-        } else {
-            std::cout << "! ERROR: Unable to handle voice off ID: 0x" << std::hex << static_cast<int>(voice) << " !" << std::endl;
-        }
+/* Times the conversion phases of one file, best of `iterations` runs. Throughput is given per phase
+against the input size and the number of decoded events. The MIDI file is built in memory, so the
+disk write doesn't skew it. Synthetic input can be made with bmsgenerator.py. With --render the SF2
+render is timed too (to memory), against the length of the audio. */
+int runBenchmark(const std::string& filename, unsigned iterations, const CommandLineOptions& commandLine) {
+    const ConversionOptions& options = commandLine.conversion;
+    MappedFile inputFile;
+    if (!inputFile.open(filename)) {
+        std::cerr << "Failed to open file: " << filename << std::endl;
+        return 1;
     }
 
+    const char* phaseNames[] = {"getTrackPointers", "parseEvents", "MIDI finalization"};
+    double best[3];
+    std::fill(std::begin(best), std::end(best), std::numeric_limits<double>::max());
+    ConversionResult result;
+    RenderResult render;
+    double bestRender = std::numeric_limits<double>::max();
+
+    for (unsigned i = 0; i < iterations; i++) {
+        result = convertBMS(inputFile.data(), inputFile.size(), options);
+        if (!result.ok) {
+            std::cerr << "Conversion failed: " << result.failure << std::endl;
+            return 1;
+        }
 
-    void turnOffRemainingNotes() {
-        std::vector<unsigned char> eventData = calculateDeltaTime();  // Delta time
-        eventData.push_back(0xB0 + statusNum);
-        eventData.push_back(0x7B);
-        eventData.push_back(0x00);  // Velocity is set to 0 for note-off
+        best[0] = std::min(best[0], result.timings.trackPointers);
+        best[1] = std::min(best[1], result.timings.decode);
+        best[2] = std::min(best[2], result.timings.midi);
 
-        writeMIDIData(eventData);
+        if (commandLine.soundFont != nullptr) {
+            std::stringstream wav;
+            render = renderWAV(result.events, result.ppqn, *commandLine.soundFont, commandLine.render, wav);
+            if (!render.ok) {
+                std::cerr << "Render failed: " << render.failure << std::endl;
+                return 1;
+            }
+            bestRender = std::min(bestRender, render.seconds);
+        }
     }
 
-    void addTime(uint32_t time) {
-        accumulatedWaitTime += time;
+    double megabytes = inputFile.size() / 1e6;
+    std::cout << "Benchmark: " << filename << ", best of " << iterations << std::endl;
+    std::cout << inputFile.size() << " bytes, " << result.trackCount << " tracks, " << result.eventCount << " events, "
+              << result.midi.size() << " MIDI bytes" << std::endl;
+    std::cout << std::left << std::setw(20) << "Phase" << std::right << std::setw(12) << "ms"
+              << std::setw(12) << "MB/s" << std::setw(16) << "events/s" << std::endl;
+    std::cout << std::fixed;
+    for (int phase = 0; phase < 3; phase++) {
+        double seconds = std::max(best[phase], 1e-9);
+        std::cout << std::left << std::setw(20) << phaseNames[phase] << std::right
+                  << std::setprecision(3) << std::setw(12) << seconds * 1e3
+                  << std::setprecision(1) << std::setw(12) << megabytes / seconds
+                  << std::setprecision(0) << std::setw(16) << result.eventCount / seconds << std::endl;
     }
+    if (commandLine.soundFont != nullptr) {
+        double audioSeconds = static_cast<double>(render.frames) / commandLine.render.sampleRate;
+        std::cout << "SF2 render: " << std::setprecision(3) << bestRender * 1e3 << " ms for " << std::setprecision(1)
+                  << audioSeconds << " s of audio, " << audioSeconds / std::max(bestRender, 1e-9) << "x real time" << std::endl;
+    }
+    return 0;
+}
 
-    void setTempo(uint16_t bpm) {
-        // Calculate the tempo value in microseconds per quarter note (MPQN)
-        uint32_t microsecondsPerQuarterNote = static_cast<uint32_t>(60000000 / bpm);
-        tempo = microsecondsPerQuarterNote;
-
-        // MIDI meta event for setting tempo
-        std::vector<unsigned char> tempoEvent = calculateDeltaTime();
-
-        // Add the tempo event data
-        tempoEvent.push_back(0xFF);
-        tempoEvent.push_back(0x51);
-        tempoEvent.push_back(0x03);
-        tempoEvent.push_back(static_cast<unsigned char>((microsecondsPerQuarterNote >> 16) & 0xFF));
-        tempoEvent.push_back(static_cast<unsigned char>((microsecondsPerQuarterNote >> 8) & 0xFF));
-        tempoEvent.push_back(static_cast<unsigned char>(microsecondsPerQuarterNote & 0xFF));
+/*Playback*/
 
-        writeMIDIData(tempoEvent);
+/* Plays one file live as raw MIDI to `output` ("-" for stdout), e.g. a FIFO a synth reads from or a
+MIDI device node. The report goes to stderr, stdout may be the MIDI stream. */
+int runPlayback(const std::string& filename, const std::string& output, const PlaybackOptions& playback,
+                const CommandLineOptions& commandLine) {
+    MappedFile inputFile;
+    if (!inputFile.open(filename)) {
+        std::cerr << "Failed to open file: " << filename << std::endl;
+        return 1;
     }
 
-    void setVolume(uint8_t volume) {
-        // MIDI control change event for volume
-        std::vector<unsigned char> volumeEvent = calculateDeltaTime();
-        volumeEvent.push_back(0xB0 + statusNum);
-        volumeEvent.push_back(0x07);
-        volumeEvent.push_back(volume);
+    ConversionOptions options = commandLine.conversion;
+    options.keepEvents = true;
+    ConversionResult result = convertBMS(inputFile.data(), inputFile.size(), options);
+    std::cerr << result.diagnostics;
+    if (!result.ok) {
+        std::cerr << result.failure << std::endl;
+        return 1;
+    }
 
-        writeMIDIData(volumeEvent);
+    std::ofstream outputFile;
+    std::ostream* sink = &std::cout;
+    if (output == "-") {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    } else {
+        // Opening a FIFO blocks until something reads from it
+        outputFile.open(output, std::ios::binary);
+        if (!outputFile) {
+            std::cerr << "Failed to open MIDI output: " << output << std::endl;
+            return 1;
+        }
+        sink = &outputFile;
     }
 
-    bool isPitchSetup = false;
+    std::cerr << "Playing " << filename << " (" << result.trackCount << " tracks, " << result.eventCount << " events)" << std::endl;
+    PlaybackResult played = playSequence(result.events, result.ppqn, *sink, playback);
+    const PlaybackStats& stats = played.stats;
 
-    void setPitch(int16_t pitch) {
+    std::cerr << std::fixed << std::setprecision(1) << stats.messages << " messages in " << stats.duration << " s, "
+              << playback.lookahead * 1e3 << " ms lookahead" << std::endl;
+    std::cerr << std::setprecision(3)
+              << "Lateness (ms): mean " << stats.meanLateness * 1e3 << ", median " << stats.medianLateness * 1e3
+              << ", p99 " << stats.p99Lateness * 1e3 << ", max " << stats.maxLateness * 1e3 << std::endl;
+    std::cerr << "Jitter: " << stats.jitter * 1e3 << " ms, " << std::dec << stats.lateMessages << " messages over 1 ms late" << std::endl;
+    std::cerr << "Queued " << stats.meanLead * 1e3 << " ms ahead on average, sink writes took " << stats.meanWrite * 1e6 << " us" << std::endl;
 
-        if (!isPitchSetup) {
-            /* Not too sure if other games BMS files require a pitch adjustment, but the TP soundfont does. */
-            uint8_t statusByte = 0xB0 + statusNum;
+    if (!played.ok) {
+        std::cerr << played.failure << std::endl;
+        return 1;
+    }
+    return 0;
+}
 
-            std::vector<unsigned char> pitchSetup = calculateDeltaTime();
-            pitchSetup.insert(pitchSetup.end(), {
-                statusByte, 0x64, 0x00,               // Pitch coarse init
-                0x00, statusByte, 0x65, 0x00,         // Pitch fine init
-                0x00, statusByte, 0x06, 0x30,         // Pitch course +30 semitones
-                0x00, statusByte, 0x26, 0x00,         // Pitch fine   +0 cents
-                0x00, statusByte, 0x64, 0x7f,         // Pitch course end
-                0x00, statusByte, 0x65, 0x7f          // pitch fine end
-                });
+/*Encoding*/
 
-            writeMIDIData(pitchSetup);
-            isPitchSetup = true;
+// Encodes a MIDI file into a .bms, next to it unless `output` is given. An existing .bms is never
+// overwritten without asking for it by name, it's likely the game file the MIDI came from.
+int runEncode(const std::string& filename, std::string output, const EncodeOptions& options) {
+    MappedFile inputFile;
+    if (!inputFile.open(filename)) {
+        std::cerr << "Failed to open file: " << filename << std::endl;
+        return 1;
+    }
+    if (output.empty()) {
+        output = filename.substr(0, filename.find_last_of('.')) + ".bms";
+        std::error_code ec;
+        if (std::filesystem::exists(output, ec)) {
+            std::cerr << output << " already exists, name the output with --bms-out" << std::endl;
+            return 1;
         }
+    }
 
-        const int16_t midiMidpoint = 0x2000; // MIDI pitch bend midpoint (16384 / 2)
-
-        // Convert the input pitch to MIDI pitch bend range (0x0000 to 0x3FFF)
-        int16_t midiPitch = pitch / 4;
+    auto start = std::chrono::steady_clock::now();
+    EncodeResult result = encodeBMS(inputFile.data(), inputFile.size(), options);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (!result.ok) {
+        std::cerr << result.failure << std::endl;
+        return 1;
+    }
 
-        // Check if the pitch is above the MIDI pitch bend midpoint, deal with inversion
-        if (midiPitch > midiMidpoint) {
-            midiPitch -= midiMidpoint; // Subtract the midpoint for pitch-up
-        } else {
-            midiPitch += midiMidpoint; // Add the midpoint for pitch-down
-        }
+    std::ofstream outputFile(output, std::ios::binary);
+    outputFile.write(reinterpret_cast<const char*>(result.bms.data()), result.bms.size());
+    outputFile.close();
+    if (!outputFile) {
+        std::cerr << "Failed to write " << output << std::endl;
+        return 1;
+    }
 
-        // Extract the lower 7 bits and upper 7 bits from the converted pitch value
-        uint8_t lsb = static_cast<uint8_t>(midiPitch & 0x7F);
-        uint8_t msb = static_cast<uint8_t>((midiPitch >> 7) & 0x7F);
+    std::cout << "Encoded " << result.noteCount << " notes into " << result.trackCount << " tracks";
+    if (result.overflowTracks > 0) {
+        std::cout << " (" << result.overflowTracks << " for channels playing more than 7 notes at once)";
+    }
+    std::cout << std::endl;
+    std::cout << result.bms.size() << " bytes, " << result.inlineBytes << " without subroutines ("
+              << result.subroutineCount << " subroutines, " << result.callCount << " calls), "
+              << std::fixed << std::setprecision(1) << seconds * 1e3 << " ms" << std::endl;
+    if (result.droppedEvents > 0) {
+        std::cout << result.droppedEvents << " events BMS has no instruction for were left out" << std::endl;
+    }
+    return 0;
+}
 
-        std::vector<unsigned char> pitchEvent = calculateDeltaTime();
-        pitchEvent.push_back(0xE0 + statusNum);
-        pitchEvent.push_back(lsb);       // Pitch bend LSB
-        pitchEvent.push_back(msb);       // Pitch bend MSB
+/*Command Line*/
 
-        writeMIDIData(pitchEvent);
+// Whole number argument of an option, false when `text` isn't one or doesn't fit in 32 bits
+bool parseNumber(const char* text, uint32_t& value) {
+    if (!std::isdigit(static_cast<unsigned char>(text[0]))) {
+        return false;
+    }
+    errno = 0;
+    char* end = nullptr;
+    unsigned long long parsed = std::strtoull(text, &end, 10);
+    if (*end != '\0' || errno == ERANGE || parsed > UINT32_MAX) {
+        return false;
     }
+    value = static_cast<uint32_t>(parsed);
+    return true;
+}
 
-    void setReverb(uint8_t value) {
-        // MIDI control change event for reverb (not sustain)
-        std::vector<unsigned char> reverbEvent = calculateDeltaTime();
-        reverbEvent.push_back(0xB0 + statusNum);
-        reverbEvent.push_back(0x5B);
-        reverbEvent.push_back(value);
+int main(int argc, char* argv[]) {
+    const char* singleUsage = " <filename> [--instruments] [--parallel-tracks] [--loops N] [--loop-markers] [--stats file.json] [--cache dir] [--render file.sf2 [--sample-rate N]] [--disasm text|json] [--errors-only] [--repeats N] [--no-running-status] [--note-on-offs] [--drop-redundant] [--range start:end]";
+    const char* batchUsage = " --batch <directory|listfile> [--jobs N] [--parallel-tracks] [--loops N] [--loop-markers] [--stats file.json] [--cache dir] [--render file.sf2 [--sample-rate N]] [--disasm text|json] [--errors-only] [--repeats N] [--no-running-status] [--note-on-offs] [--drop-redundant]";
+    const char* archiveUsage = " <archive.arc> [--jobs N] [--parallel-tracks] [--loops N] [--loop-markers] [--stats file.json] [--cache dir] [--render file.sf2 [--sample-rate N]] [--disasm text|json] [--errors-only] [--repeats N] [--no-running-status] [--note-on-offs] [--drop-redundant]";
+    const char* benchmarkUsage = " --benchmark <filename> [--iterations N] [--parallel-tracks] [--jobs N] [--loops N] [--render file.sf2]";
+    const char* playUsage = " --play <filename> [--midi-out file|-] [--lookahead ms] [--loops N] [--loop-markers] [--range start:end]";
+    const char* encodeUsage = " --encode <file.mid> [--bms-out file.bms] [--no-subroutines]";
 
-        writeMIDIData(reverbEvent);
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << singleUsage << std::endl;
+        std::cerr << "       " << argv[0] << batchUsage << std::endl;
+        std::cerr << "       " << argv[0] << archiveUsage << std::endl;
+        std::cerr << "       " << argv[0] << benchmarkUsage << std::endl;
+        std::cerr << "       " << argv[0] << playUsage << std::endl;
+        std::cerr << "       " << argv[0] << encodeUsage << std::endl;
+        return 1;
     }
 
-    void addPan(uint8_t pan) {
-        // MIDI control change event for pan
-        std::vector<unsigned char> panEvent = calculateDeltaTime();
-        panEvent.push_back(0xB0 + statusNum);
-        panEvent.push_back(0x0A);
-        panEvent.push_back(pan);
-
-        writeMIDIData(panEvent);
+    bool batch = std::string(argv[1]) == "--batch";
+    bool benchmark = std::string(argv[1]) == "--benchmark";
+    bool play = std::string(argv[1]) == "--play";
+    bool encode = std::string(argv[1]) == "--encode";
+    bool printInstruments = false;
+    CommandLineOptions options;
+    unsigned jobs = std::thread::hardware_concurrency();
+    unsigned iterations = 5;
+    std::string cacheDirectory;
+    std::string soundFontFile;
+    std::string midiOutput = "-";
+    PlaybackOptions playback;
+    std::string range;
+    EncodeOptions encoding;
+    std::string bmsOutput;
+
+    // Option arguments are checked as they're read, a missing or malformed one prints the mode's usage
+    auto usageError = [&](const std::string& problem) {
+        const char* usage = encode ? encodeUsage : play ? playUsage : benchmark ? benchmarkUsage
+                          : batch ? batchUsage : isArchive(argv[1]) ? archiveUsage : singleUsage;
+        std::cerr << problem << std::endl;
+        std::cerr << "Usage: " << argv[0] << usage << std::endl;
+    };
+    auto optionValue = [&](int& i, std::string& value) {
+        if (i + 1 >= argc) {
+            usageError(std::string(argv[i]) + " needs a value");
+            return false;
+        }
+        value = argv[++i];
+        return true;
+    };
+    auto numericValue = [&](int& i, uint32_t& value) {
+        std::string text;
+        if (!optionValue(i, text)) {
+            return false;
+        }
+        if (!parseNumber(text.c_str(), value)) {
+            usageError(std::string(argv[i - 1]) + " takes a whole number, not " + text);
+            return false;
+        }
+        return true;
+    };
+    uint32_t number = 0;
+
+    for (int i = (batch || benchmark || play || encode) ? 3 : 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--instruments") {
+            printInstruments = true;
+        } else if (arg == "--parallel-tracks") {
+            options.parallelTracks = true;
+        } else if (arg == "--jobs") {
+            if (!numericValue(i, number)) {
+                return 1;
+            }
+            jobs = number;
+        } else if (arg == "--loops") {
+            if (!numericValue(i, number)) {
+                return 1;
+            }
+            options.conversion.loopCount = std::max<uint32_t>(1, number);
+        } else if (arg == "--loop-markers") {
+            options.conversion.loopMarkers = true;
+        } else if (arg == "--stats") {
+            if (!optionValue(i, options.statsFile)) {
+                return 1;
+            }
+            options.conversion.collectStats = true;
+        } else if (arg == "--cache") {
+            if (!optionValue(i, cacheDirectory)) {
+                return 1;
+            }
+        } else if (arg == "--disasm") {
+            if (!optionValue(i, options.disassembly)) {
+                return 1;
+            }
+            if (options.disassembly != "text" && options.disassembly != "json") {
+                usageError("--disasm takes text or json");
+                return 1;
+            }
+        } else if (arg == "--render") {
+            if (!optionValue(i, soundFontFile)) {
+                return 1;
+            }
+        } else if (arg == "--sample-rate") {
+            if (!numericValue(i, number)) {
+                return 1;
+            }
+            options.render.sampleRate = std::max<uint32_t>(8000, number);
+        } else if (arg == "--iterations") {
+            if (!numericValue(i, number)) {
+                return 1;
+            }
+            iterations = std::max<unsigned>(1, number);
+        } else if (arg == "--midi-out") {
+            if (!optionValue(i, midiOutput)) {
+                return 1;
+            }
+        } else if (arg == "--lookahead") {
+            if (!numericValue(i, number)) {
+                return 1;
+            }
+            playback.lookahead = number / 1e3;
+        } else if (arg == "--errors-only") {
+            options.conversion.minimumSeverity = Severity::Error;
+        } else if (arg == "--repeats") {
+            if (!numericValue(i, options.conversion.diagnosticRepeats)) {
+                return 1;
+            }
+        } else if (arg == "--no-running-status") {
+            options.conversion.runningStatus = false;
+        } else if (arg == "--note-on-offs") {
+            options.conversion.noteOffsAsNoteOns = true;
+        } else if (arg == "--drop-redundant") {
+            options.conversion.dropRedundantEvents = true;
+        } else if (arg == "--bms-out") {
+            if (!optionValue(i, bmsOutput)) {
+                return 1;
+            }
+        } else if (arg == "--no-subroutines") {
+            encoding.subroutines = false;
+        } else if (arg == "--range") {
+            if (!optionValue(i, range)) {
+                return 1;
+            }
+        } else {
+            usageError("unknown option " + arg);
+            return 1;
+        }
     }
 
-    void trackReset() {
-        //Basics to reset variables for new track
-        accumulatedWaitTime = 0;
-        previousEventTimestamp = 0;
-        VisitedAddresses.clear();
-        VisitedAddresses.reserve(8192);
-        VisitedAddressMax = 0;
-        trackStartMarker = midiData.size();
-        isPitchSetup = false;
-        firstTrack = false;
+    if (encode) {
+        if (argc < 3) {
+            std::cerr << "Usage: " << argv[0] << encodeUsage << std::endl;
+            return 1;
+        }
+        return runEncode(argv[2], bmsOutput, encoding);
     }
 
-    /*Main Run*/
+    // Ranges are for auditioning or clipping one sequence
+    SeekIndex seekIndex;
+    if (!range.empty()) {
+        if (batch || benchmark || (!play && isArchive(argv[1]))) {
+            std::cerr << "--range only works on a single file or with --play" << std::endl;
+            return 1;
+        }
+        if (argc < 3 && play) {
+            std::cerr << "Usage: " << argv[0] << playUsage << std::endl;
+            return 1;
+        }
+        if (!applyRange(play ? argv[2] : argv[1], range, seekIndex, options.conversion)) {
+            return 1;
+        }
+    }
 
-    void init() {
+    if (play) {
+        if (argc < 3) {
+            std::cerr << "Usage: " << argv[0] << playUsage << std::endl;
+            return 1;
+        }
+        return runPlayback(argv[2], midiOutput, playback, options);
+    }
 
-        getTrackPointers();
+    // Loaded once and shared by every conversion of the run
+    SoundFont soundFont;
+    if (!soundFontFile.empty()) {
+        MappedFile soundFontData;
+        std::string failure;
+        if (!soundFontData.open(soundFontFile)) {
+            std::cerr << "Failed to open file: " << soundFontFile << std::endl;
+            return 1;
+        }
+        if (!soundFont.load(soundFontData.data(), soundFontData.size(), failure)) {
+            std::cerr << soundFontFile << ": " << failure << std::endl;
+            return 1;
+        }
+        options.soundFont = &soundFont;
+        options.conversion.keepEvents = true;
+    }
 
-        // std::cout << "Track List:" << std::endl;
-        // for (const auto& track : trackList) {
-        //     std::cout << "Track No: " << static_cast<int>(std::get<0>(track))
-        //               << ", Track Start: " << static_cast<int>(std::get<1>(track))
-        //               << ", Track End: " << static_cast<int>(std::get<2>(track)) << std::endl;
-        // }
+    // The benchmark always converts, a cache would only time the lookups
+    ConversionCache cache;
+    if (!cacheDirectory.empty() && !benchmark) {
+        if (!cache.open(cacheDirectory)) {
+            std::cerr << "Failed to create cache directory: " << cacheDirectory << std::endl;
+            return 1;
+        }
+        cache.reuseFiles = !printInstruments && options.statsFile.empty() && options.soundFont == nullptr && options.disassembly.empty();
+        options.cache = &cache;
+        options.conversion.trackCache = &cache;
+    }
 
-        for (const auto& track : trackList) {
-            // Makes hexcode neater, but also prevents track 0's error code being 255
-            trackNum = (std::get<0>(track) == 0x00) ? std::get<0>(track) : (std::get<0>(track) - 1);
-            uint32_t trackStart = std::get<1>(track);
-            uint32_t trackEnd = std::get<2>(track);
-            parseEvents(trackStart, trackEnd);
-            turnOffRemainingNotes();
-            handleTrackPoints();
-            trackReset();
+    if (batch) {
+        if (argc < 3) {
+            std::cerr << "Usage: " << argv[0] << batchUsage << std::endl;
+            return 1;
         }
+        return runBatch(argv[2], jobs, options);
+    }
 
-        handleMIDIHeader(); // Add header
-        finalizeMIDIFile();
-        std::cout << "BMS file converted" << std::endl;
+    if (!benchmark && isArchive(argv[1])) {
+        return runArchive(argv[1], jobs, options);
     }
 
-    void printTrackInstruments() {
-        for (const auto& instrument : trackInstruments) {
-            uint8_t trackNum = std::get<0>(instrument);
-            uint8_t program = std::get<1>(instrument);
-            std::cout << "TrackNum: " << std::dec << static_cast<int>(trackNum) << ", Program: " << std::dec << static_cast<int>(program) << std::endl;
-        }
+    // Only spun up when asked for, a single small file isn't worth the threads (rendering always is)
+    std::unique_ptr<WorkStealingPool> trackPool;
+    if (options.parallelTracks || options.soundFont != nullptr) {
+        trackPool = std::make_unique<WorkStealingPool>(jobs);
+        options.conversion.trackPool = options.parallelTracks ? trackPool.get() : nullptr;
+        options.render.pool = trackPool.get();
     }
-};
 
-int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <filename> [--instruments]" << std::endl;
-        return 1;
+    if (benchmark) {
+        if (argc < 3) {
+            std::cerr << "Usage: " << argv[0] << benchmarkUsage << std::endl;
+            return 1;
+        }
+        return runBenchmark(argv[2], iterations, options);
     }
 
     std::string filename = argv[1];
-    std::string midiFilename = filename.substr(0, filename.find_last_of('.')) + ".mid";
 
-    std::ifstream inputFile(filename, std::ios::binary);
-    if (!inputFile) {
-        std::cerr << "Failed to open file: " << filename << std::endl;
+    RenderResult rendered;
+    ConversionResult result = convertFile(filename, options, &rendered);
+    std::cout << result.diagnostics;
+    if (!options.statsFile.empty() && !writeStatsFile(options.statsFile, {filename}, {result})) {
         return 1;
     }
-
-    std::ofstream outputFile(midiFilename, std::ios::binary);
-    if (!outputFile) {
-        std::cerr << "Failed to create MIDI file: " << midiFilename << std::endl;
+    if (!result.ok) {
+        std::cerr << result.failure << std::endl;
         return 1;
     }
-
-    std::vector<unsigned char> hexData(
-        (std::istreambuf_iterator<char>(inputFile)),
-        (std::istreambuf_iterator<char>()));
-
-    while (!hexData.empty() && hexData.back() == 0x00) {
-        hexData.pop_back();
+    std::cout << "BMS file converted";
+    if (result.cachedTracks > 0) {
+        std::cout << " (" << std::dec << result.cachedTracks << " of " << result.trackCount << " tracks cached)";
+    }
+    std::cout << std::endl;
+    if (options.soundFont != nullptr) {
+        double audioSeconds = static_cast<double>(rendered.frames) / options.render.sampleRate;
+        std::cout << "WAV rendered: " << std::fixed << std::setprecision(1) << audioSeconds << " s of audio in "
+                  << std::setprecision(3) << rendered.seconds << " s" << std::endl;
     }
-
-    TrackParser parser;
-    parser.hexData = hexData;
-    parser.outputFile = std::move(outputFile);
-    parser.init();
 
     // Check if the --instruments argument is present
-    if (argc >= 3 && std::string(argv[2]) == "--instruments") {
-        // Call the printTrackInstruments function
+    if (printInstruments) {
         std::cout << "Track Instruments:" << std::endl;
-        parser.printTrackInstruments();
+        for (const auto& instrument : result.trackInstruments) {
+            uint8_t trackNum = std::get<0>(instrument);
+            uint8_t program = std::get<1>(instrument);
+            std::cout << "TrackNum: " << std::dec << static_cast<int>(trackNum) << ", Program: " << std::dec << static_cast<int>(program) << std::endl;
+        }
     }
 
     return 0;
@@ -0,0 +1,2496 @@
+#include "bmsconverter.h"
+#include "eventstream.h"
+#include "mml.h"
+#include "workstealingpool.h"
+
+#include <vector>
+#include <tuple>
+#include <array>
+#include <iomanip>
+#include <algorithm>
+#include <stack>
+#include <stdexcept>
+#include <sstream>
+#include <string>
+#include <initializer_list>
+#include <atomic>
+#include <memory>
+#include <exception>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <iterator>
+#include <utility>
+
+/* BMS to MIDI converter
+
+- AZ
+
+ */
+
+/*Opcode Tables*/
+
+// What the decoder does with an opcode, parseEvents switches over these
+enum OpAction : uint8_t {
+    OP_UNKNOWN,
+    OP_NOTE_ON,
+    OP_NOTE_OFF,
+    OP_WAIT,
+    OP_CALL,
+    OP_RET,
+    OP_JUMP,
+    OP_FIN,
+    OP_OPEN_TRACK,
+    OP_SET_BANK,
+    OP_SET_PROG,
+    OP_SET_PERF_U8,
+    OP_SET_PERF_S8,
+    OP_SET_PERF_S16,
+    OP_SET_ARTIC,
+    OP_TEMPO,
+    OP_SKIP
+};
+
+// How the operands following the opcode are laid out
+enum OperandLayout : uint8_t {
+    OPERANDS_FIXED,     // `length` bytes
+    OPERANDS_VLQ,       // One variable-length quantity
+    OPERANDS_STRING,    // Zero terminated, then zero padded
+    OPERANDS_UNTIL_FLOW // Everything up to the next track flow opcode (OPEN_TRACK..JUMP_COND)
+};
+
+struct OpcodeDescriptor {
+    const char* name = "UNKNOWN";
+    OpAction action = OP_UNKNOWN;
+    uint8_t length = 0; // Operand bytes after the opcode, including any that are skipped
+    OperandLayout layout = OPERANDS_FIXED;
+};
+
+using OpcodeTable = std::array<OpcodeDescriptor, 256>;
+
+// JAudio 2 (Twilight Princess) opcodes
+constexpr OpcodeTable makeJAudio2Opcodes() {
+    OpcodeTable table{};
+
+    for (int i = 0x00; i < 0x80; i++) {
+        table[i] = {"NOTE_ON", OP_NOTE_ON, 2};      // Note is the opcode, then voice, velocity
+    }
+    for (int i = 0x81; i < 0x88; i++) {
+        table[i] = {"NOTE_OFF", OP_NOTE_OFF, 0};    // Voice is the low bits of the opcode
+    }
+
+    table[WAIT_8]           = {"WAIT_8", OP_WAIT, 1};
+    table[WAIT_16]          = {"WAIT_16", OP_WAIT, 2};
+    table[WAIT_24]          = {"WAIT_24", OP_WAIT, 3};
+    table[WAIT_VAR]         = {"WAIT_VAR", OP_WAIT, 0, OPERANDS_VLQ};
+
+    table[OPEN_TRACK]       = {"OPEN_TRACK", OP_OPEN_TRACK, 4};
+    table[CALL]             = {"CALL", OP_CALL, 3};
+    table[RET]              = {"RET", OP_RET, 0};
+    table[JUMP]             = {"JUMP", OP_JUMP, 3};
+    table[FIN]              = {"FIN", OP_FIN, 0};
+
+    table[J2_SET_BANK]      = {"J2_SET_BANK", OP_SET_BANK, 1};
+    table[J2_SET_PROG]      = {"J2_SET_PROG", OP_SET_PROG, 1};
+    table[J2_SET_PERF_8]    = {"J2_SET_PERF_8", OP_SET_PERF_S8, 2};
+    table[J2_SET_PERF_16]   = {"J2_SET_PERF_16", OP_SET_PERF_S16, 3};
+    table[J2_SET_ARTIC]     = {"J2_SET_ARTIC", OP_SET_ARTIC, 3};
+    table[J2_TEMPO]         = {"J2_TEMPO", OP_TEMPO, 2};
+    table[NOTE_TRACK]       = {"NOTE_TRACK", OP_SKIP, 2};
+
+    table[PERF_U8_NODUR]    = {"PERF_U8_NODUR", OP_SET_PERF_U8, 2};
+    table[PERF_U8_DUR_U8]   = {"PERF_U8_DUR_U8", OP_SET_PERF_U8, 3};
+    table[PERF_U8_DUR_U16]  = {"PERF_U8_DUR_U16", OP_SET_PERF_U8, 4};
+    table[PERF_S8_NODUR]    = {"PERF_S8_NODUR", OP_SET_PERF_S8, 2};
+    table[PERF_S8_DUR_U8]   = {"PERF_S8_DUR_U8", OP_SET_PERF_S8, 3};
+    table[PERF_S8_DUR_U16]  = {"PERF_S8_DUR_U16", OP_SET_PERF_S8, 4};
+    table[PERF_S16_NODUR]   = {"PERF_S16_NODUR", OP_SET_PERF_S16, 3};
+    table[PERF_S16_DUR_U8]  = {"PERF_S16_DUR_U8", OP_SET_PERF_S16, 4};
+    table[PERF_S16_DUR_U16] = {"PERF_S16_DUR_U16", OP_SET_PERF_S16, 5};
+
+    table[OPEN_TRACK_BROS]  = {"OPEN_TRACK_BROS", OP_SKIP, 1};
+    table[CALL_COND]        = {"CALL_COND", OP_SKIP, 4};
+    table[RET_COND]         = {"RET_COND", OP_SKIP, 1};
+    table[JUMP_COND]        = {"JUMP_COND", OP_SKIP, 4};
+    table[NAME_BUS]         = {"NAME_BUS", OP_SKIP, 2};
+    table[D1]               = {"D1", OP_SKIP, 2};
+    table[D5]               = {"D5", OP_SKIP, 0};
+    table[D9]               = {"D9", OP_SKIP, 3};
+    table[DA]               = {"DA", OP_SKIP, 0, OPERANDS_UNTIL_FLOW};
+    table[DC]               = {"DC", OP_SKIP, 11};
+    table[SYNC_CPU]         = {"SYNC_CPU", OP_SKIP, 2};
+    table[EB]               = {"EB", OP_SKIP, 0};
+    table[FA]               = {"FA", OP_SKIP, 5};
+    table[NAME_CHECK]       = {"NAME_CHECK", OP_SKIP, 0, OPERANDS_STRING};
+
+    return table;
+}
+
+/* Game dialects, parseEvents is instantiated once per dialect so dispatch is a plain table lookup.
+Another JAudio game plugs in with its own struct, usually by starting from makeJAudio2Opcodes()
+and overriding the opcodes that differ. */
+struct TwilightPrincess {
+    static constexpr OpcodeTable opcodes = makeJAudio2Opcodes();
+};
+
+enum class GameDialect {
+    TwilightPrincess
+};
+
+const uint8_t INHERITED_CHANNEL = 0xFF; // Events before the track's first program change keep the previous track's channel
+
+struct DecodedTrack {
+    uint8_t trackNum = 0;
+    EventStream events;
+    std::vector<uint8_t> programs;              // Distinct programs in the order the track selects them, indexed by program slot
+    uint8_t lastProgramSlot = INHERITED_CHANNEL; // Slot still selected when the track ends
+};
+
+/*Track Cache Entries*/
+
+// Serializes cache entries, the cache only lives on the machine that wrote it so values are stored as they are in memory
+struct EntryWriter {
+    std::string data;
+
+    template <typename T>
+    void write(const T& value) {
+        data.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    void writeColumn(const std::vector<T>& column) {
+        data.append(reinterpret_cast<const char*>(column.data()), column.size() * sizeof(T));
+    }
+
+    void writeString(const std::string& text) {
+        write(static_cast<uint32_t>(text.size()));
+        data += text;
+    }
+};
+
+// Reads an entry back, any read past the end marks it bad so a damaged entry is just a miss
+struct EntryReader {
+    const std::string& data;
+    size_t position = 0;
+    bool ok = true;
+
+    explicit EntryReader(const std::string& data) : data(data) {}
+
+    bool take(void* out, size_t size) {
+        if (!ok || data.size() - position < size) {
+            ok = false;
+            return false;
+        }
+        if (size > 0) {
+            std::memcpy(out, data.data() + position, size);
+            position += size;
+        }
+        return true;
+    }
+
+    template <typename T>
+    T read() {
+        T value{};
+        take(&value, sizeof(T));
+        return value;
+    }
+
+    // Element count of a list, checked against the bytes left (`elementSize` each) before anything is allocated for it
+    size_t readCount(size_t elementSize) {
+        uint32_t count = read<uint32_t>();
+        if (!ok || (data.size() - position) / elementSize < count) {
+            ok = false;
+            return 0;
+        }
+        return count;
+    }
+
+    template <typename T>
+    void readColumn(std::vector<T>& column, size_t count) {
+        if (!ok || (data.size() - position) / sizeof(T) < count) {
+            ok = false;
+            return;
+        }
+        column.resize(count);
+        take(column.data(), count * sizeof(T));
+    }
+
+    std::string readString() {
+        uint32_t length = read<uint32_t>();
+        std::string text;
+        if (ok && data.size() - position >= length) {
+            text = data.substr(position, length);
+            position += length;
+        } else {
+            ok = false;
+        }
+        return text;
+    }
+};
+
+/*MIDI Writer*/
+
+/* Serializes decoded tracks into a format 1 Standard MIDI File. Without a sink the whole file is built up
+in midiData, with one every chunk is flushed to the sink once it's finished, so midiData only ever holds
+the track being written. */
+struct MidiWriter {
+    std::vector<unsigned char> midiData;
+    uint32_t previousEventTimestamp = 0;
+    size_t trackStartMarker = 0;
+    bool isPitchSetup = false;
+
+    // Encoding settings, see ConversionOptions
+    bool runningStatus = true;
+    bool noteOffsAsNoteOns = false;
+    bool dropRedundantEvents = false;
+
+    uint8_t runningStatusByte = 0; // Status of the track's last channel event, 0 after a meta event
+
+    // Controller values the writer keeps track of, per channel of the track being written
+    enum ChannelValue : uint8_t {
+        CV_VOLUME,
+        CV_PAN,
+        CV_REVERB,
+        CV_PITCH_BEND,
+        CHANNEL_VALUES
+    };
+    static constexpr uint16_t NO_VALUE = 0xFFFF; // Nothing written yet, pitch bends only go up to 0x3FFF
+    uint16_t channelValues[16][CHANNEL_VALUES];
+
+    std::ostream* sink = nullptr;
+    size_t flushedBytes = 0;
+    std::streampos headerPosition = 0; // Where the header went in the sink
+    uint16_t headerTrackCount = 0;     // Values the header was written with
+    uint16_t headerPPQN = 0;
+
+    void writeMIDIData(std::initializer_list<unsigned char> eventData) {
+        midiData.insert(midiData.end(), eventData);
+    }
+
+    void writeVLQ(uint32_t input) {
+        // Conversion back to VLQ (used for MIDI), encoded straight into midiData
+        unsigned char buf[5];
+        uint8_t length = 0;
+
+        do {
+            buf[length++] = static_cast<unsigned char>(input & 0x7F);
+            input >>= 7;
+        } while (input > 0);
+
+        // Groups were collected low to high, every byte but the last gets the continuation bit
+        while (length > 1) {
+            midiData.push_back(buf[--length] | 0x80);
+        }
+        midiData.push_back(buf[0]);
+    }
+
+    void writeDeltaTime(uint32_t tick) {
+        uint32_t deltaTime = tick - previousEventTimestamp;
+        previousEventTimestamp = tick; // Update timestamp
+        writeVLQ(deltaTime);
+    }
+
+    // Delta time followed by the event bytes, no intermediate buffers. Only used for meta events, which
+    // cancel running status
+    void writeMIDIEvent(uint32_t tick, std::initializer_list<unsigned char> eventData) {
+        writeDeltaTime(tick);
+        writeMIDIData(eventData);
+        runningStatusByte = 0;
+    }
+
+    // Left out when it repeats the previous channel event's, readers carry that one over
+    void writeStatus(uint8_t status) {
+        if (!runningStatus || status != runningStatusByte) {
+            midiData.push_back(status);
+        }
+        runningStatusByte = status;
+    }
+
+    // Channel voice event, `kind` is the status byte without the channel (0x80, 0x90, 0xB0...)
+    void writeChannelEvent(uint32_t tick, uint8_t kind, uint8_t channel, uint8_t data1, uint8_t data2) {
+        writeDeltaTime(tick);
+        writeStatus(static_cast<uint8_t>(kind + channel));
+        writeMIDIData({data1, data2});
+    }
+
+    void writeChannelEvent(uint32_t tick, uint8_t kind, uint8_t channel, uint8_t data1) {
+        writeDeltaTime(tick);
+        writeStatus(static_cast<uint8_t>(kind + channel));
+        midiData.push_back(data1);
+    }
+
+    /* Records `value` as the channel's current one, false when the channel already has it and the event can
+    be dropped. Only this track's events are seen, so dropping is off unless asked for: tracks playing the
+    same program share a channel and may have changed it in between. */
+    bool changesValue(uint8_t channel, ChannelValue which, uint16_t value) {
+        uint16_t& current = channelValues[channel & 0x0F][which];
+        if (dropRedundantEvents && current == value) {
+            return false;
+        }
+        current = value;
+        return true;
+    }
+
+    // Overwrites an already reserved big-endian field (chunk lengths, header counts)
+    void patchMIDIData(std::size_t position, uint32_t value, uint8_t byteCount) {
+        for (uint8_t i = 0; i < byteCount; i++) {
+            midiData[position + i] = static_cast<unsigned char>(value >> (8 * (byteCount - 1 - i)) & 0xFF);
+        }
+    }
+
+    // Hands the finished chunks over to the sink, if there is one
+    void flushChunks() {
+        if (sink != nullptr) {
+            sink->write(reinterpret_cast<const char*>(midiData.data()), midiData.size());
+            flushedBytes += midiData.size();
+            midiData.clear();
+        }
+    }
+
+    void beginMIDIFile(size_t trackCount, int16_t ppqn) {
+        // MIDI header with the values known so far, handleMIDIHeader corrects them at the end
+        headerTrackCount = static_cast<uint16_t>(trackCount);
+        headerPPQN = static_cast<uint16_t>(ppqn);
+        writeMIDIData({'M', 'T', 'h', 'd', 0x00, 0x00, 0x00, 0x06, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00});
+        patchMIDIData(10, headerTrackCount, 2);
+        patchMIDIData(12, headerPPQN, 2);
+
+        if (sink != nullptr) {
+            headerPosition = sink->tellp();
+            flushChunks();
+        }
+    }
+
+    void beginTrack() {
+        // MIDI track header, the length is patched in by handleTrackPoints
+        writeMIDIData({'M', 'T', 'r', 'k', 0x00, 0x00, 0x00, 0x00});
+        trackStartMarker = midiData.size();
+        previousEventTimestamp = 0;
+        isPitchSetup = false;
+        runningStatusByte = 0;
+        std::fill(&channelValues[0][0], &channelValues[0][0] + 16 * CHANNEL_VALUES, NO_VALUE);
+    }
+
+    // Ends the track, returns the size of its whole chunk
+    size_t handleTrackPoints() {
+        // Write the track end
+        writeMIDIData({0x00, 0xFF, 0x2F, 0x00});
+
+        // Track length (accounts for track end)
+        size_t trackLength = midiData.size() - trackStartMarker;
+        patchMIDIData(trackStartMarker - 4, static_cast<uint32_t>(trackLength), 4);
+        flushChunks();
+        return trackLength + 8;
+    }
+
+    void handleMIDIHeader(size_t trackCount, int16_t ppqn) {
+        uint16_t headerValues[2] = {static_cast<uint16_t>(trackCount), static_cast<uint16_t>(ppqn)};
+        if (sink == nullptr) {
+            patchMIDIData(10, headerValues[0], 2);
+            patchMIDIData(12, headerValues[1], 2);
+        } else if (headerValues[0] != headerTrackCount || headerValues[1] != headerPPQN) {
+            // Only seeks back when a track changed the PPQN, otherwise the sink doesn't need to be seekable
+            unsigned char fields[4] = {
+                static_cast<unsigned char>(headerValues[0] >> 8), static_cast<unsigned char>(headerValues[0] & 0xFF),
+                static_cast<unsigned char>(headerValues[1] >> 8), static_cast<unsigned char>(headerValues[1] & 0xFF)};
+            std::streampos end = sink->tellp();
+            sink->seekp(headerPosition + std::streamoff(10));
+            sink->write(reinterpret_cast<const char*>(fields), sizeof(fields));
+            sink->seekp(end);
+        }
+        headerTrackCount = headerValues[0];
+        headerPPQN = headerValues[1];
+    }
+
+    void writePitchSetup(uint32_t tick, uint8_t channel) {
+        /* Not too sure if other games BMS files require a pitch adjustment, but the TP soundfont does. */
+        // Only the first event carries a delta, the rest follow at the same tick
+        writeChannelEvent(tick, 0xB0, channel, 0x64, 0x00);    // Pitch coarse init
+        writeChannelEvent(tick, 0xB0, channel, 0x65, 0x00);    // Pitch fine init
+        writeChannelEvent(tick, 0xB0, channel, 0x06, PITCH_BEND_RANGE); // Pitch course +48 semitones
+        writeChannelEvent(tick, 0xB0, channel, 0x26, 0x00);    // Pitch fine   +0 cents
+        writeChannelEvent(tick, 0xB0, channel, 0x64, 0x7f);    // Pitch course end
+        writeChannelEvent(tick, 0xB0, channel, 0x65, 0x7f);    // pitch fine end
+    }
+
+    void writeMarker(uint32_t tick, const std::string& text) {
+        // Marker meta event
+        writeMIDIEvent(tick, {0xFF, 0x06});
+        writeVLQ(static_cast<uint32_t>(text.size()));
+        midiData.insert(midiData.end(), text.begin(), text.end());
+    }
+
+    size_t writeTrack(const EventStream& events) {
+        beginTrack();
+
+        for (size_t i = 0; i < events.size(); i++) {
+            uint32_t tick = events.ticks[i];
+            uint8_t channel = events.channels[i];
+            uint32_t value = events.data1[i];
+
+            switch (events.types[i]) {
+                case EV_NOTE_ON:
+                    writeChannelEvent(tick, 0x90, channel, value, events.data2[i]);
+                    break;
+                case EV_NOTE_OFF:
+                    if (noteOffsAsNoteOns) {
+                        writeChannelEvent(tick, 0x90, channel, value, 0x00);
+                    } else {
+                        writeChannelEvent(tick, 0x80, channel, value, 0x40);  // Release velocity
+                    }
+                    break;
+                case EV_PROGRAM: {
+                    uint8_t bank = value / 128;
+                    uint8_t actualProgram = value - 128 * bank;
+                    bank += FIRST_BANK;
+                    writeChannelEvent(tick, 0xB0, channel, 0x00, bank);    // MIDI bank select event
+                    writeChannelEvent(tick, 0xC0, channel, actualProgram); // MIDI program change event
+                    break;
+                }
+                case EV_VOLUME:
+                    if (changesValue(channel, CV_VOLUME, value)) {
+                        writeChannelEvent(tick, 0xB0, channel, 0x07, value);
+                    }
+                    break;
+                case EV_PAN:
+                    if (changesValue(channel, CV_PAN, value)) {
+                        writeChannelEvent(tick, 0xB0, channel, 0x0A, value);
+                    }
+                    break;
+                case EV_REVERB:
+                    // Reverb (not sustain)
+                    if (changesValue(channel, CV_REVERB, value)) {
+                        writeChannelEvent(tick, 0xB0, channel, 0x5B, value);
+                    }
+                    break;
+                case EV_PITCH_BEND:
+                    if (!changesValue(channel, CV_PITCH_BEND, value)) {
+                        break;
+                    }
+                    if (!isPitchSetup) {
+                        writePitchSetup(tick, channel);
+                        isPitchSetup = true;
+                    }
+                    writeChannelEvent(tick, 0xE0, channel, value & 0x7F, (value >> 7) & 0x7F);  // Pitch bend LSB, MSB
+                    break;
+                case EV_TEMPO:
+                    // MIDI meta event for setting tempo
+                    writeMIDIEvent(tick, {
+                        0xFF, 0x51, 0x03,
+                        static_cast<unsigned char>((value >> 16) & 0xFF),
+                        static_cast<unsigned char>((value >> 8) & 0xFF),
+                        static_cast<unsigned char>(value & 0xFF)
+                        });
+                    break;
+                case EV_ALL_NOTES_OFF:
+                    writeChannelEvent(tick, 0xB0, channel, 0x7B, 0x00);
+                    break;
+                case EV_MARKER:
+                    writeMarker(tick, (value == LOOP_START) ? "loopStart" : "loopEnd");
+                    break;
+            }
+        }
+
+        return handleTrackPoints();
+    }
+};
+
+/*Diagnostics*/
+
+/* Decode problems are recorded as Diagnostic records and only formatted once, for the report at the end of
+the conversion. Past `repeatLimit` of one code in one track they're only counted, so a badly broken file
+costs a counter per bad instruction instead of a growing log. */
+struct DiagnosticInfo {
+    Severity severity;
+    const char* name; // For counting left out repeats
+};
+
+// Indexed by DiagnosticCode
+static const DiagnosticInfo diagnosticInfo[] = {
+    {Severity::Error, "bad note voices"},
+    {Severity::Error, "unknown opcodes"},
+    {Severity::Notice, "unknown initial track bytes"},
+    {Severity::Error, "unknown SET_PERF types"},
+    {Severity::Notice, "unusual effect parameters"},
+    {Severity::Error, "bad voice offs"},
+    {Severity::Error, "programs past channel 16"},
+    {Severity::Error, "tracks past the end of the file"},
+    {Severity::Error, "truncated instructions"},
+};
+
+static const char* severityName(Severity severity) {
+    return severity == Severity::Error ? "error" : "notice";
+}
+
+struct DiagnosticLog {
+    Severity minimumSeverity = Severity::Notice;
+    uint32_t repeatLimit = 0; // 0 keeps everything
+    std::vector<Diagnostic> records;
+
+    struct Repeats {
+        DiagnosticCode code;
+        uint8_t trackNum;
+        uint32_t seen;
+        uint32_t suppressed;
+    };
+
+    std::vector<Repeats> repeats; // Only a handful of codes ever come up per file, searched linearly
+
+    // Empty log with the same settings
+    DiagnosticLog fresh() const {
+        DiagnosticLog log;
+        log.minimumSeverity = minimumSeverity;
+        log.repeatLimit = repeatLimit;
+        return log;
+    }
+
+    void add(const Diagnostic& diagnostic) {
+        if (diagnosticSeverity(diagnostic.code) < minimumSeverity) {
+            return;
+        }
+        Repeats& counts = repeatsOf(diagnostic.code, diagnostic.trackNum);
+        counts.seen++;
+        if (repeatLimit == 0 || counts.seen <= repeatLimit) {
+            records.push_back(diagnostic);
+        } else {
+            counts.suppressed++;
+        }
+    }
+
+    // Adds another log's diagnostics after this one's, the limit applies to the two together
+    void append(const DiagnosticLog& other) {
+        for (const Diagnostic& diagnostic : other.records) {
+            add(diagnostic);
+        }
+        for (const Repeats& counts : other.repeats) {
+            if (counts.suppressed > 0) {
+                Repeats& ours = repeatsOf(counts.code, counts.trackNum);
+                ours.seen += counts.suppressed;
+                ours.suppressed += counts.suppressed;
+            }
+        }
+    }
+
+    uint32_t suppressed() const {
+        uint32_t total = 0;
+        for (const Repeats& counts : repeats) {
+            total += counts.suppressed;
+        }
+        return total;
+    }
+
+    std::string report() const {
+        std::string text;
+        for (const Diagnostic& diagnostic : records) {
+            text += formatDiagnostic(diagnostic);
+            text += '\n';
+        }
+        for (const Repeats& counts : repeats) {
+            if (counts.suppressed > 0) {
+                const DiagnosticInfo& info = diagnosticInfo[static_cast<size_t>(counts.code)];
+                text += severityName(info.severity);
+                text += ": " + std::to_string(counts.suppressed) + " more " + info.name + " in track " +
+                        std::to_string(counts.trackNum) + " left out\n";
+            }
+        }
+        return text;
+    }
+
+    void write(EntryWriter& entry) const {
+        entry.write(static_cast<uint32_t>(records.size()));
+        entry.writeColumn(records);
+        entry.write(static_cast<uint32_t>(repeats.size()));
+        entry.writeColumn(repeats);
+    }
+
+    // Codes index diagnosticInfo, an entry with one it doesn't have is bad
+    void read(EntryReader& entry) {
+        entry.readColumn(records, entry.read<uint32_t>());
+        entry.readColumn(repeats, entry.read<uint32_t>());
+        auto knownCode = [](DiagnosticCode code) { return static_cast<size_t>(code) < std::size(diagnosticInfo); };
+        for (const Diagnostic& record : records) {
+            entry.ok = entry.ok && knownCode(record.code);
+        }
+        for (const Repeats& counts : repeats) {
+            entry.ok = entry.ok && knownCode(counts.code);
+        }
+    }
+
+private:
+    Repeats& repeatsOf(DiagnosticCode code, uint8_t trackNum) {
+        for (Repeats& counts : repeats) {
+            if (counts.code == code && counts.trackNum == trackNum) {
+                return counts;
+            }
+        }
+        repeats.push_back({code, trackNum, 0, 0});
+        return repeats.back();
+    }
+};
+
+/*Disassembly*/
+
+/* Instruction trace, a line for every decoded instruction as text or JSON. Lines are formatted by hand
+into a fixed buffer that goes out in large writes, nothing is allocated per instruction. */
+struct DisassemblyWriter {
+    static const size_t BUFFER_SIZE = 1 << 16;
+    static const size_t LINE_RESERVE = 192; // Everything of a line but the operands
+
+    bool enabled = false;
+    bool json = false;
+    std::ostream* out = nullptr;   // Written here, or kept in `collected` when null (tracks decoded on a pool)
+    std::string collected;
+    std::unique_ptr<char[]> buffer;
+    size_t used = 0;
+
+    void begin(std::ostream* sink, bool asJSON) {
+        enabled = true;
+        json = asJSON;
+        out = sink;
+        buffer.reset(new char[BUFFER_SIZE]);
+    }
+
+    void flush() {
+        if (used == 0) {
+            return;
+        }
+        if (out != nullptr) {
+            out->write(buffer.get(), used);
+        } else {
+            collected.append(buffer.get(), used);
+        }
+        used = 0;
+    }
+
+    void write(const std::string& text) {
+        flush();
+        if (out != nullptr) {
+            out->write(text.data(), text.size());
+        } else {
+            collected += text;
+        }
+    }
+
+    void instruction(uint8_t track, uint32_t offset, size_t depth, uint32_t tick, uint8_t opcode, const char* name,
+                     const unsigned char* operands, size_t operandCount) {
+        reserve(LINE_RESERVE);
+        if (json) {
+            put("{\"track\":");
+            putDecimal(track);
+            put(",\"offset\":");
+            putDecimal(offset);
+            put(",\"depth\":");
+            putDecimal(depth);
+            put(",\"tick\":");
+            putDecimal(tick);
+            put(",\"opcode\":");
+            putDecimal(opcode);
+            put(",\"name\":\"");
+            put(name);
+            put("\",\"operands\":[");
+            for (size_t i = 0; i < operandCount; i++) {
+                reserve(8);
+                if (i > 0) {
+                    buffer[used++] = ',';
+                }
+                putDecimal(operands[i]);
+            }
+            reserve(3);
+            put("]}\n");
+        } else {
+            put("track ");
+            putDecimal(track);
+            put(" 0x");
+            putHex(offset, offset > 0xFFFFFF ? 8 : 6);
+            put(" depth ");
+            putDecimal(depth);
+            put(" tick ");
+            putDecimal(tick);
+            buffer[used++] = ' ';
+            putHex(opcode, 2);
+            buffer[used++] = ' ';
+            put(name);
+            for (size_t i = 0; i < operandCount; i++) {
+                reserve(4);
+                buffer[used++] = ' ';
+                putHex(operands[i], 2);
+            }
+            reserve(1);
+            buffer[used++] = '\n';
+        }
+    }
+
+private:
+    // The put functions don't check for room, a line reserves it first
+    void reserve(size_t count) {
+        if (used + count > BUFFER_SIZE) {
+            flush();
+        }
+    }
+
+    void put(const char* text) {
+        while (*text != '\0') {
+            buffer[used++] = *text++;
+        }
+    }
+
+    void putDecimal(uint64_t value) {
+        char digits[20];
+        int count = 0;
+        do {
+            digits[count++] = static_cast<char>('0' + value % 10);
+            value /= 10;
+        } while (value != 0);
+        while (count > 0) {
+            buffer[used++] = digits[--count];
+        }
+    }
+
+    void putHex(uint32_t value, int width) {
+        static const char hexDigits[] = "0123456789abcdef";
+        for (int shift = (width - 1) * 4; shift >= 0; shift -= 4) {
+            buffer[used++] = hexDigits[(value >> shift) & 0xF];
+        }
+    }
+};
+
+/*Track Parser*/
+
+// Read-only view over the BMS bytes, the parser decodes straight out of the caller's buffer
+struct ByteSpan {
+    const unsigned char* ptr = nullptr;
+    size_t length = 0;
+
+    ByteSpan() = default;
+    ByteSpan(const unsigned char* ptr, size_t length) : ptr(ptr), length(length) {}
+
+    const unsigned char& operator[](size_t index) const { return ptr[index]; }
+    const unsigned char* data() const { return ptr; }
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+};
+
+struct TrackParser {
+    ByteSpan hexData;
+    bool paddedInput = false; // Zero padding was trimmed off the end of hexData
+    uint32_t curOffset;
+
+    TrackParser() : curOffset(0) {}
+
+    int16_t ppqn = 0x0078; // Pulses per Quarter Note (default 120)
+    bool ppqnChanged = false;
+    int32_t tempo = 0x491803; // Tempo (default of 4790275 MPQN [microseconds per quarter note])
+    std::vector<std::tuple<uint8_t, uint32_t>> trackList; // TrackList [trackNo, trackStart], a track ends where its code runs into another's
+
+    uint8_t voiceToNote[8] = {}; // Array to remember the current note played by each voice ID
+
+    struct StackFrame {
+        uint32_t retOffset;
+        uint32_t target;         // Subroutine offset, it's cached under this when it returns
+        uint32_t eventIndex;     // Events decoded before the call
+        uint32_t tick;
+        uint32_t sideEffects;    // Counters on entry, if either moved the call can't be cached
+        uint32_t errorCount;
+        uint8_t channelSlot;     // Entry state the subroutine's events depend on
+        uint8_t voiceToNote[8];
+    };
+
+    std::stack<StackFrame> callStack; // Call return positions
+
+    /* Subroutine cache. Pattern subroutines get called over and over with the same state, the first call
+    is decoded and every later one with the same target, channel slot and voices replays its events. */
+    struct CachedCall {
+        uint32_t target;
+        uint8_t entrySlot;
+        uint8_t entryVoices[8];
+        uint8_t exitSlot;
+        uint8_t exitVoices[8];
+        uint32_t firstEvent;     // Events [firstEvent, lastEvent) of the decoded call
+        uint32_t lastEvent;
+        uint32_t entryTick;
+        uint32_t duration;
+    };
+
+    std::vector<CachedCall> callCache; // Per track, the events it points at belong to the track being decoded
+    uint32_t sideEffects = 0; // Bumped by anything a replay wouldn't reproduce (jumps, ppqn changes, notices)
+
+    // One bit per byte of hexData, set for every instruction offset the track has executed
+    std::vector<uint64_t> visitedAddresses;
+
+    /* Loop rendering. A JUMP back into played code is the track's endless loop, by default it's dropped (one pass).
+    With loopCount > 1 the body is played loopCount times in total and the track ends there, later passes
+    replay the events already decoded for the first one instead of interpreting the bytecode again. */
+    uint32_t loopCount = 1;
+    bool loopMarkers = false; // Surround the first pass of every loop with loopStart/loopEnd markers
+
+    struct LoopMark {
+        uint32_t eventIndex; // Events decoded before the instruction last ran
+        uint32_t tick;
+    };
+
+    std::vector<LoopMark> loopMarks; // Per byte of hexData, only filled when rendering loops
+    std::vector<std::pair<size_t, EventStream>> pendingMarkers;
+
+    bool renderingLoops() const {
+        return loopCount > 1 || loopMarkers;
+    }
+
+    uint8_t trackNum = 0x00;
+
+    bool firstTrack = true;
+
+    std::vector<std::tuple<uint8_t, uint8_t>> trackInstruments; // [trackNum, program]
+
+    DiagnosticLog diagnostics; // Per-parser, so concurrent conversions don't interleave
+    uint32_t errorCount = 0;
+
+    // Only touched by the Instrumented instantiations (stats or disassembly), the default path does neither
+    bool collectStats = false;
+    ConversionStats stats;
+    uint64_t trackInstructions = 0;
+    DisassemblyWriter disassembly;
+
+    /*Track Decoding*/
+
+    /* Decodes the track from `offset` (its start, or where a checkpoint left off) straight out of the bytes.
+    The track ends at a FIN, or where it runs into another track's first instruction (or where the root
+    track's code ends), wherever the code before it goes. */
+    template <typename Dialect, bool Instrumented>
+    void parseEvents(uint32_t trackStart, uint32_t offset) {
+        curOffset = offset;
+        uint32_t nextEntry = entryFrom(curOffset); // Checked as offsets pass it, looked up again after a jump, call or return
+
+        while (true) {
+            if (curOffset >= nextEntry) {
+                if (curOffset == nextEntry && curOffset != trackStart) {
+                    return;
+                }
+                nextEntry = entryFrom(curOffset + 1);
+            }
+            if (curOffset >= hexData.size()) {
+                // Running into the end of the file just ends the track, calls past it are an error
+                if (curOffset != hexData.size()) {
+                    diagnose(DiagnosticCode::TrackPastEnd, curOffset, 0, 0, static_cast<int32_t>(hexData.size()));
+                }
+                return;
+            }
+            markVisited(curOffset);
+            uint8_t status_byte = hexData[curOffset++];
+            const OpcodeDescriptor& op = Dialect::opcodes[status_byte];
+            if constexpr (Instrumented) {
+                if (collectStats) {
+                    stats.opcodeCounts[status_byte]++;
+                    trackInstructions++;
+                }
+            }
+
+            // Bounds are checked once per instruction, fixed operands are read unchecked after this
+            if (static_cast<size_t>(curOffset) + op.length > hexData.size() ||
+                (op.layout != OPERANDS_FIXED && !operandsFit(op))) {
+                diagnose(DiagnosticCode::TruncatedInstruction, curOffset - 1, status_byte, 0, static_cast<int32_t>(hexData.size()));
+                return;
+            }
+
+            if constexpr (Instrumented) {
+                if (disassembly.enabled) {
+                    traceInstruction(op, curOffset - 1);
+                }
+            }
+
+            switch (op.action) {
+                case OP_NOTE_ON: {
+                    uint8_t note = status_byte;
+                    uint8_t voice = hexData[curOffset++];
+                    uint8_t velocity = hexData[curOffset++];
+
+                    if (voice < 0x01 || voice > 0x08) {
+                            if (firstTrack) {
+                                firstTrackErrorHandling(status_byte, curOffset - 3);
+                                return;
+                            } else {
+                                diagnose(DiagnosticCode::BadNoteVoice, curOffset - 3, note, voice);
+                                throw std::runtime_error("A Note byte could not be read");
+                            }
+                    };
+                    voiceToNote[voice - 1] = note;
+                    handleNoteOn(note, velocity);
+                    break;
+                }
+                case OP_NOTE_OFF: {
+                    uint8_t voice = status_byte & ~0x80;
+                    handleNoteOff(voice);
+                    break;
+                }
+                case OP_WAIT: {
+                    uint32_t waitTime = 0;
+                    if (op.layout == OPERANDS_VLQ) {
+                        readVLQ(waitTime);
+                    } else {
+                        waitTime = readFixed(op.length);
+                    }
+                    addTime(waitTime);
+                    if (accumulatedWaitTime >= nextTimeCheck && timeCheck()) {
+                        return;
+                    }
+                    break;
+                }
+                case OP_JUMP: {
+                    uint32_t jumpOffset = read24();
+                    sideEffects++; // Where a jump goes depends on what was played before
+                    if (buildingIndex && jumpOffset < hexData.size()) {
+                        jumpTargets.push_back(jumpOffset);
+                    }
+
+                    // Only follow the jump if its target hasn't been played yet
+                    if (jumpOffset < hexData.size() && !isOffsetUsed(jumpOffset)) {
+                        curOffset = jumpOffset;
+                        nextEntry = entryFrom(curOffset);
+                    } else if (jumpOffset < hexData.size() && renderingLoops()) {
+                        // Target was already played, render the loop instead of following it forever.
+                        // Nothing after an unconditional jump is reached, the loop is where the track ends
+                        renderLoop(jumpOffset);
+                        return;
+                    } else {
+                        // Target was already played, following it would loop forever
+                        //std::cerr << "Warning: Infinite loop detected in jump. Skipping jump instruction." << std::endl;
+                    }
+                    break;
+                }
+                case OP_CALL: {
+                    uint32_t callOffset = read24();
+                    if (const CachedCall* cached = findCachedCall(callOffset)) {
+                        replayCall(*cached); // Already decoded with this state, carry on after the call
+                        if (accumulatedWaitTime >= nextTimeCheck && timeCheck()) {
+                            return;
+                        }
+                    } else {
+                        callStack.push(enterCall(callOffset)); // Save the return address (next instruction after the call)
+                        curOffset = callOffset;
+                        nextEntry = entryFrom(curOffset);
+                    }
+                    break;
+                }
+                case OP_RET: {
+                    if (!callStack.empty()) {
+                        const StackFrame& frame = callStack.top();
+                        if (frame.sideEffects == sideEffects && frame.errorCount == errorCount) {
+                            cacheCall(frame);
+                        }
+                        curOffset = frame.retOffset;
+                        nextEntry = entryFrom(curOffset);
+                        callStack.pop(); // Pop the return address from the call stack
+                    }
+                    break;
+                }
+                case OP_SET_BANK: {
+                    // Banks are setup with setProgram, the BMS versions are discarded.
+                    curOffset += op.length;
+                    break;
+                }
+                case OP_SET_PROG: {
+                    uint8_t prog = hexData[curOffset++];
+                    // Only run program if it isn't followed up by another program change
+                    if (!isValidOffset() || hexData[curOffset] != status_byte) { // status_byte is this dialect's program opcode
+                        setProgram(prog);
+                    }
+                    break;
+                }
+                case OP_SET_PERF_U8:
+                case OP_SET_PERF_S8:
+                case OP_SET_PERF_S16: {
+                    uint32_t endOffset = curOffset + op.length;
+                    uint8_t type = hexData[curOffset++];
+                    double value;
+                    if (op.action == OP_SET_PERF_U8) {
+                        value = hexData[curOffset++];
+                    } else if (op.action == OP_SET_PERF_S8) {
+                        value = static_cast<int8_t>(hexData[curOffset++]);
+                    } else {
+                        value = static_cast<int16_t>(read16());
+                    }
+                    curOffset = endOffset; // Fade durations aren't converted, the value is set straight away
+                    setEffect(type, value, endOffset - op.length - 1);
+                    break;
+                }
+                case OP_FIN:
+                    return;
+                case OP_SET_ARTIC: {
+                    uint8_t type = hexData[curOffset++];
+                    if (type == 0x62) {
+                        uint16_t eventPPQN = read16();
+                        ppqn = eventPPQN;
+                        ppqnChanged = true;
+                        sideEffects++;
+                    } else {
+                        curOffset += 2;
+                    }
+                    break;
+                }
+                case OP_TEMPO: {
+                    uint16_t bpm = read16();
+                    setTempo(bpm);
+                    break;
+                }
+                case OP_OPEN_TRACK: {
+                    curOffset += op.length;
+                    break;
+                }
+                case OP_SKIP: {
+                    skipOperands(op);
+                    break;
+                }
+                case OP_UNKNOWN:
+                default: {
+                    if (firstTrack) {
+                        firstTrackErrorHandling(status_byte, curOffset - 1);
+                        return;
+                    } else {
+                        diagnose(DiagnosticCode::UnknownOpcode, curOffset - 1, status_byte, curOffset >= 2 ? hexData[curOffset - 2] : 0);
+                        return;
+                    }
+                }
+            }
+        }
+    }
+
+    void traceInstruction(const OpcodeDescriptor& op, uint32_t offset) {
+        uint32_t savedOffset = curOffset;
+        skipOperands(op);
+        uint32_t end = static_cast<uint32_t>(std::min<size_t>(curOffset, hexData.size()));
+        curOffset = savedOffset;
+        disassembly.instruction(trackNum, offset, callStack.size(), accumulatedWaitTime, hexData[offset], op.name,
+                                hexData.data() + offset + 1, end - offset - 1);
+    }
+
+    // Moves past the operands, false when they run past the end of the file
+    bool skipOperands(const OpcodeDescriptor& op) {
+        switch (op.layout) {
+            case OPERANDS_FIXED:
+                curOffset += op.length;
+                return true;
+            case OPERANDS_VLQ: {
+                uint32_t value;
+                return readVLQ(value);
+            }
+            case OPERANDS_STRING:
+                // Skip bytes until a 0x00 is encountered, the padding's when the string ends the file
+                do {
+                    if (!isValidOffset()) {
+                        return paddedInput;
+                    }
+                } while (hexData[curOffset++] != 0x00);
+                // When one is encountered, keep skipping until the byte isn't 0x00
+                while (isValidOffset() && hexData[curOffset] == 0x00) {
+                    curOffset++;
+                }
+                return true;
+            case OPERANDS_UNTIL_FLOW:
+                // Stop on anything between OPEN_TRACK and JUMP_COND
+                while (isValidOffset() && (hexData[curOffset] < OPEN_TRACK || hexData[curOffset] > JUMP_COND)) {
+                    curOffset++;
+                }
+                return true;
+        }
+        return true;
+    }
+
+    bool operandsFit(const OpcodeDescriptor& op) {
+        uint32_t savedOffset = curOffset;
+        bool fits = skipOperands(op);
+        curOffset = savedOffset;
+        return fits;
+    }
+
+    void setEffect(uint8_t type, double value, uint32_t offset) {
+        if (type == MML_VOLUME){
+            uint8_t midValue = value;
+            setVolume(midValue);
+        } else if (type == MML_PITCH){
+            uint16_t midValue = value;
+            setPitch(midValue);
+        }else if (type == MML_REVERB) {
+            uint8_t midValue = value;
+            setReverb(midValue);
+        } else if (type == MML_PAN) {
+            uint8_t midValue = value;
+            addPan(midValue);
+        } else if (type == MML_EFFECT_UNKNOWN) {
+            if (value != 0x00) {
+                sideEffects++;
+                diagnose(DiagnosticCode::UnusualEffect, offset, type, 0, static_cast<int32_t>(value));
+            }
+        } else {
+            diagnose(DiagnosticCode::UnknownPerfType, offset, type, 0, static_cast<int32_t>(value));
+        }
+    }
+
+    void markVisited(uint32_t offset) {
+        if (offset < hexData.size()) {
+            visitedAddresses[offset >> 6] |= uint64_t(1) << (offset & 63);
+            if (!loopMarks.empty()) {
+                loopMarks[offset] = {static_cast<uint32_t>(decoded.events.size()), accumulatedWaitTime};
+            }
+            if (!firstVisits.empty()) {
+                visitCount++;
+                if (firstVisits[offset] == 0) {
+                    firstVisits[offset] = visitCount;
+                }
+            }
+        }
+    }
+
+    void renderLoop(uint32_t loopStart) {
+        const LoopMark& mark = loopMarks[loopStart];
+        size_t bodyStart = mark.eventIndex;
+        size_t bodyEnd = decoded.events.size();
+        uint32_t bodyTicks = accumulatedWaitTime - mark.tick;
+
+        if (loopMarkers) {
+            // Markers go in once the track is done, so event indexes stay valid until then
+            EventStream startMarker;
+            startMarker.push(mark.tick, EV_MARKER, channelSlot, LOOP_START);
+            pendingMarkers.emplace_back(bodyStart, std::move(startMarker));
+            EventStream endMarker;
+            endMarker.push(accumulatedWaitTime, EV_MARKER, channelSlot, LOOP_END);
+            pendingMarkers.emplace_back(bodyEnd, std::move(endMarker));
+        }
+
+        // Events up to the body's first program change were on the channel the loop was entered with,
+        // later passes are entered with whatever the body left selected
+        size_t firstProgram = bodyStart;
+        while (firstProgram < bodyEnd && decoded.events.types[firstProgram] != EV_PROGRAM) {
+            firstProgram++;
+        }
+
+        for (uint32_t pass = 1; pass < loopCount; pass++) {
+            size_t passStart = decoded.events.size();
+            decoded.events.replay(bodyStart, bodyEnd, bodyTicks * pass);
+            std::fill(decoded.events.channels.begin() + passStart,
+                      decoded.events.channels.begin() + passStart + (firstProgram - bodyStart), channelSlot);
+        }
+        accumulatedWaitTime += bodyTicks * (loopCount - 1);
+    }
+
+    StackFrame enterCall(uint32_t target) const {
+        StackFrame frame;
+        frame.retOffset = curOffset;
+        frame.target = target;
+        frame.eventIndex = static_cast<uint32_t>(decoded.events.size());
+        frame.tick = accumulatedWaitTime;
+        frame.sideEffects = sideEffects;
+        frame.errorCount = errorCount;
+        frame.channelSlot = channelSlot;
+        std::copy(std::begin(voiceToNote), std::end(voiceToNote), frame.voiceToNote);
+        return frame;
+    }
+
+    const CachedCall* findCachedCall(uint32_t target) const {
+        for (const auto& call : callCache) {
+            if (call.target == target && call.entrySlot == channelSlot &&
+                std::equal(std::begin(voiceToNote), std::end(voiceToNote), call.entryVoices)) {
+                return &call;
+            }
+        }
+        return nullptr;
+    }
+
+    void cacheCall(const StackFrame& frame) {
+        CachedCall call;
+        call.target = frame.target;
+        call.entrySlot = frame.channelSlot;
+        std::copy(std::begin(frame.voiceToNote), std::end(frame.voiceToNote), call.entryVoices);
+        call.exitSlot = channelSlot;
+        std::copy(std::begin(voiceToNote), std::end(voiceToNote), call.exitVoices);
+        call.firstEvent = frame.eventIndex;
+        call.lastEvent = static_cast<uint32_t>(decoded.events.size());
+        call.entryTick = frame.tick;
+        call.duration = accumulatedWaitTime - frame.tick;
+        callCache.push_back(call);
+    }
+
+    // Leaves the parser as if the subroutine had been decoded again. Instruction offsets were already
+    // marked by the first call, so a loop starting inside a subroutine uses that call's position
+    void replayCall(const CachedCall& call) {
+        size_t first = decoded.events.size();
+        decoded.events.replay(call.firstEvent, call.lastEvent, accumulatedWaitTime - call.entryTick);
+
+        for (size_t i = first; i < decoded.events.size(); i++) {
+            if (decoded.events.types[i] == EV_PROGRAM) {
+                trackInstruments.push_back(std::make_tuple(trackNum, static_cast<uint8_t>(decoded.events.data1[i])));
+                decoded.lastProgramSlot = decoded.events.channels[i];
+            } else if (decoded.events.types[i] == EV_TEMPO) {
+                tempo = decoded.events.data1[i];
+            }
+        }
+
+        channelSlot = call.exitSlot;
+        std::copy(std::begin(call.exitVoices), std::end(call.exitVoices), voiceToNote);
+        accumulatedWaitTime += call.duration;
+    }
+
+    // The first track entry at or after `offset`, where a track running into it stops
+    uint32_t entryFrom(uint32_t offset) const {
+        auto entry = std::lower_bound(trackEntries.begin(), trackEntries.end(), offset);
+        return entry != trackEntries.end() ? *entry : UINT32_MAX;
+    }
+
+    bool isOffsetUsed(uint32_t offset) const {
+        return (visitedAddresses[offset >> 6] >> (offset & 63)) & 1;
+    }
+
+    /* Reads a VLQ (variable-length quantity), false when the end of the file cuts it short. The zero padding
+    after the file's bytes ends one, the quantity then ends with the bytes. */
+    bool readVLQ(uint32_t& value) {
+        value = 0;
+        uint8_t c;
+        do {
+            if (!isValidOffset()) {
+                value <<= 7;
+                return paddedInput;
+            }
+            c = hexData[curOffset++];
+            value = (value << 7) + (c & 0x7F);
+        } while (c & 0x80);
+        return true;
+    }
+
+    bool isValidOffset() {
+        return (curOffset < hexData.size());
+    }
+
+    uint32_t readFixed(uint8_t length) {
+        switch (length) {
+            case 1:
+                return hexData[curOffset++];
+            case 2:
+                return read16();
+            case 3:
+                return read24();
+        }
+        curOffset += length;
+        return 0;
+    }
+
+    // Operand reads, only called once parseEvents has checked the instruction fits in the file
+    uint16_t read16() {
+        uint16_t value = (static_cast<uint16_t>(hexData[curOffset]) << 8) | static_cast<uint16_t>(hexData[curOffset + 1]);
+        curOffset += 2;
+        return value;
+    }
+
+    uint32_t read24() {
+        uint32_t value = (static_cast<uint32_t>(hexData[curOffset]) << 16) |
+                         (static_cast<uint32_t>(hexData[curOffset + 1]) << 8) |
+                         static_cast<uint32_t>(hexData[curOffset + 2]);
+        curOffset += 3;
+        return value;
+    }
+
+    uint32_t getWord(uint32_t nIndex) {
+        if (static_cast<size_t>(nIndex) + 4 > hexData.size()) {
+            throw std::out_of_range("Offset is out of bounds");
+        }
+        return ((static_cast<uint32_t>(hexData[nIndex]) << 24) +
+                (static_cast<uint32_t>(hexData[nIndex + 1]) << 16) +
+                (static_cast<uint32_t>(hexData[nIndex + 2]) << 8) +
+                static_cast<uint32_t>(hexData[nIndex + 3]));
+    }
+
+    bool addedStartingTrackStart = false;
+
+    void scanForTracks(uint32_t offset) {
+        if (!addedStartingTrackStart) {
+            trackList.push_back(std::make_tuple(0, 0));
+            addedStartingTrackStart = true;
+        }
+        while (static_cast<size_t>(offset) + 5 <= hexData.size() && hexData[offset] == OPEN_TRACK) {
+            uint8_t trackNo = hexData[offset + 1];
+            uint32_t trackStart = getWord(offset + 1) & 0x00FFFFFF;
+            scanForTracks(trackStart);
+            trackList.push_back(std::make_tuple(trackNo + 1, trackStart));
+            offset += 0x05;
+        }
+    }
+
+    std::vector<uint32_t> trackEntries;     // Every track's start and the root track's end, sorted, where tracks stop
+
+    // Finds the tracks, their code is only walked once each one is decoded
+    void getTrackPointers() {
+        scanForTracks(0);
+
+        // The "last track" (scanned along with first track) is where the first track's own code ends
+        uint32_t rootEnd = std::get<1>(trackList.back());
+        trackList.pop_back();
+
+        trackEntries.push_back(rootEnd);
+        for (const auto& track : trackList) {
+            trackEntries.push_back(std::get<1>(track));
+        }
+        std::sort(trackEntries.begin(), trackEntries.end());
+        trackEntries.erase(std::unique(trackEntries.begin(), trackEntries.end()), trackEntries.end());
+    }
+
+    // Records a problem in the current track, errors are counted even when they're filtered out
+    void diagnose(DiagnosticCode code, uint32_t offset, uint8_t byte0 = 0, uint8_t byte1 = 0, int32_t value = 0) {
+        if (diagnosticSeverity(code) == Severity::Error) {
+            errorCount++;
+        }
+        diagnostics.add({code, trackNum, {byte0, byte1}, offset, value});
+    }
+
+    void firstTrackErrorHandling(uint8_t status_byte, uint32_t offset) {
+        diagnose(DiagnosticCode::UnknownInitialByte, offset, status_byte);
+    }
+
+    /*Event Creation*/
+
+    MidiWriter midiWriter;
+    uint32_t accumulatedWaitTime = 0;
+
+    std::vector<std::tuple<uint8_t, uint8_t>> midiMappings;
+    int currentMidiMapping;
+    uint8_t statusNum = 0x00;
+
+    DecodedTrack decoded;                   // Track being decoded
+    std::vector<DecodedTrack> tracks;       // Finished tracks, in trackList order
+    uint8_t channelSlot = INHERITED_CHANNEL;
+
+    void addEvent(EventType type, uint32_t value1, uint8_t value2 = 0) {
+        decoded.events.push(accumulatedWaitTime, type, channelSlot, value1, value2);
+    }
+
+    // Program to MIDI channel (statusNum), channels are handed out in the order programs are first seen
+    uint8_t mapProgram(uint8_t program, uint8_t selectingTrack) {
+        // Assumed that program select is always first in the track
+        // Check if the MIDI mapping already exists in the list
+        bool mappingExists = false;
+        uint8_t newStatusNum = 0x00;
+
+        for (const auto& mapping : midiMappings) {
+            if (std::get<1>(mapping) == program) {
+                mappingExists = true;
+                newStatusNum = std::get<0>(mapping);
+                break;
+            }
+        }
+
+        if (!mappingExists) {
+            // Determine the new statusNum based on the last statusNum in the vector
+            newStatusNum = midiMappings.empty() ? 0x00 : (std::get<0>(midiMappings.back()) + 1);
+
+            // Add the MIDI mapping to the global list
+            midiMappings.push_back(std::make_tuple(newStatusNum, program));
+        }
+
+        if (newStatusNum >= 0x10) {
+            // Only known once channels are handed out, there's no instruction to point at
+            errorCount++;
+            diagnostics.add({DiagnosticCode::TooManyChannels, selectingTrack, {program, 0}, 0, newStatusNum});
+        }
+        return newStatusNum;
+    }
+
+    /* Channels can only be known once every earlier track has mapped its programs, so tracks are
+    decoded against program slots and resolved here, in trackList order. */
+    void resolveChannels() {
+        for (auto& track : tracks) {
+            resolveChannels(track);
+        }
+    }
+
+    void resolveChannels(DecodedTrack& track) {
+        uint8_t inheritedStatusNum = statusNum;
+        uint8_t slotStatusNums[256];
+        for (size_t slot = 0; slot < track.programs.size(); slot++) {
+            slotStatusNums[slot] = mapProgram(track.programs[slot], track.trackNum);
+        }
+        if (track.lastProgramSlot != INHERITED_CHANNEL) {
+            statusNum = slotStatusNums[track.lastProgramSlot];
+        }
+
+        for (uint8_t& channel : track.events.channels) {
+            channel = (channel == INHERITED_CHANNEL) ? inheritedStatusNum : slotStatusNums[channel];
+        }
+    }
+
+    void setProgram(uint8_t program) {
+        auto slot = std::find(decoded.programs.begin(), decoded.programs.end(), program);
+        if (slot == decoded.programs.end()) {
+            slot = decoded.programs.insert(slot, program);
+        }
+        channelSlot = static_cast<uint8_t>(slot - decoded.programs.begin());
+        decoded.lastProgramSlot = channelSlot;
+
+        trackInstruments.push_back(std::make_tuple(trackNum, program));
+
+        addEvent(EV_PROGRAM, program);
+    }
+
+    void handleNoteOn(uint8_t note, uint8_t velocity) {
+        addEvent(EV_NOTE_ON, note, velocity);
+    }
+
+    void handleNoteOff(uint8_t voice) {
+
+        // Validate voice ID
+        if (voice > 0 && voice <= 8) {
+            // Retrieve the note being played by the specified voice
+            uint8_t note = voiceToNote[voice-1];
+
+            // Reset the voice ID to indicate it's available
+            voiceToNote[voice-1] = 0;
+
+            addEvent(EV_NOTE_OFF, note);
+        } else {
+            diagnose(DiagnosticCode::BadVoiceOff, curOffset - 1, voice); // Voice offs are a single byte
+        }
+    }
+
+
+    void turnOffRemainingNotes() {
+        addEvent(EV_ALL_NOTES_OFF, 0);
+    }
+
+    void addTime(uint32_t time) {
+        accumulatedWaitTime += time;
+    }
+
+    void setTempo(uint16_t bpm) {
+        // Calculate the tempo value in microseconds per quarter note (MPQN)
+        uint32_t microsecondsPerQuarterNote = static_cast<uint32_t>(60000000 / bpm);
+        tempo = microsecondsPerQuarterNote;
+
+        addEvent(EV_TEMPO, microsecondsPerQuarterNote);
+    }
+
+    void setVolume(uint8_t volume) {
+        addEvent(EV_VOLUME, volume);
+    }
+
+    void setPitch(int16_t pitch) {
+        const int16_t midiMidpoint = 0x2000; // MIDI pitch bend midpoint (16384 / 2)
+
+        // Convert the input pitch to MIDI pitch bend range (0x0000 to 0x3FFF)
+        int16_t midiPitch = pitch / 4;
+
+        // Check if the pitch is above the MIDI pitch bend midpoint, deal with inversion
+        if (midiPitch > midiMidpoint) {
+            midiPitch -= midiMidpoint; // Subtract the midpoint for pitch-up
+        } else {
+            midiPitch += midiMidpoint; // Add the midpoint for pitch-down
+        }
+
+        addEvent(EV_PITCH_BEND, static_cast<uint16_t>(midiPitch) & 0x3FFF);
+    }
+
+    void setReverb(uint8_t value) {
+        addEvent(EV_REVERB, value);
+    }
+
+    void addPan(uint8_t pan) {
+        addEvent(EV_PAN, pan);
+    }
+
+    void trackReset() {
+        //Basics to reset variables for new track
+        accumulatedWaitTime = 0;
+        std::fill(visitedAddresses.begin(), visitedAddresses.end(), 0);
+        firstTrack = false;
+        // Voices and calls belong to the track, nothing carries over into the next one
+        std::fill(std::begin(voiceToNote), std::end(voiceToNote), 0);
+        callStack = {};
+        callCache.clear();
+        channelSlot = INHERITED_CHANNEL;
+    }
+
+    /*Track Cache*/
+
+    /* Tracks are cached decoded (events still on program slots), channels are resolved and MIDI written
+    as usual. An entry lists the bytecode ranges the track read, it's only reused while those hash the same. */
+    TrackCache* trackCache = nullptr;
+    size_t cachedTracks = 0;
+
+    typedef std::vector<std::pair<uint32_t, uint32_t>> ByteRanges;
+
+    // Key for a track's entry, everything besides the bytecode that the decoded track depends on
+    std::string trackCacheKey(size_t index, const std::tuple<uint8_t, uint32_t>& track) const {
+        EntryWriter key;
+        key.data = converterVersion();
+        key.write(static_cast<uint64_t>(index));
+        key.write(std::get<0>(track));
+        key.write(std::get<1>(track));
+        key.write(static_cast<uint32_t>(trackEntries.size())); // Where the track stops
+        key.writeColumn(trackEntries);
+        key.write(static_cast<uint64_t>(hexData.size()));
+        key.write(static_cast<uint8_t>(paddedInput));
+        key.write(static_cast<uint8_t>(dialect));
+        key.write(loopCount);
+        key.write(loopMarkers);
+        key.write(diagnostics.minimumSeverity); // The entry keeps the track's diagnostics as filtered
+        key.write(diagnostics.repeatLimit);
+
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(key.data.data());
+        std::ostringstream name;
+        name << std::hex << std::setfill('0') << std::setw(16) << hashBytes(bytes, key.data.size(), 0)
+             << std::setw(16) << hashBytes(bytes, key.data.size(), 1);
+        return name.str();
+    }
+
+    // Every byte the track's decode looked at, worked out from the visited instruction offsets
+    template <typename Dialect>
+    ByteRanges coveredRanges() {
+        ByteRanges ranges;
+        uint32_t savedOffset = curOffset;
+
+        for (size_t word = 0; word < visitedAddresses.size(); word++) {
+            for (uint32_t bit = 0; bit < 64 && visitedAddresses[word] != 0; bit++) {
+                if (!((visitedAddresses[word] >> bit) & 1)) {
+                    continue;
+                }
+                uint32_t start = static_cast<uint32_t>(word * 64 + bit);
+                const OpcodeDescriptor& op = Dialect::opcodes[hexData[start]];
+
+                // Where parseEvents left the instruction, a truncated one was reported and just its opcode read
+                curOffset = start + 1;
+                if (static_cast<size_t>(curOffset) + op.length > hexData.size() || !skipOperands(op)) {
+                    curOffset = start + 1;
+                }
+                uint32_t end = curOffset;
+                if (op.action == OP_SET_PROG) {
+                    end = std::min<uint32_t>(end + 1, static_cast<uint32_t>(hexData.size())); // Looks ahead for a second program change
+                } else if (op.action == OP_UNKNOWN && start > 0) {
+                    start--; // The error report prints the byte before
+                }
+
+                if (!ranges.empty() && start <= ranges.back().second) {
+                    ranges.back().second = std::max(ranges.back().second, end);
+                } else {
+                    ranges.emplace_back(start, end);
+                }
+            }
+        }
+
+        curOffset = savedOffset;
+        return ranges;
+    }
+
+    void hashRanges(const ByteRanges& ranges, uint64_t hash[2]) const {
+        hash[0] = 0;
+        hash[1] = 1;
+        for (const auto& range : ranges) {
+            hash[0] = hashBytes(hexData.data() + range.first, range.second - range.first, hash[0]);
+            hash[1] = hashBytes(hexData.data() + range.first, range.second - range.first, hash[1]);
+        }
+    }
+
+    // Restores a cached track, false (and nothing changed) when there's no entry or its bytecode was edited
+    bool loadCachedTrack(const std::string& key) {
+        std::string entry;
+        if (!trackCache->load(key, entry)) {
+            return false;
+        }
+
+        EntryReader reader(entry);
+        ByteRanges ranges(reader.readCount(2 * sizeof(uint32_t)));
+        for (auto& range : ranges) {
+            range.first = reader.read<uint32_t>();
+            range.second = reader.read<uint32_t>();
+            if (range.first > range.second || range.second > hexData.size()) {
+                return false;
+            }
+        }
+        uint64_t storedHash[2] = {reader.read<uint64_t>(), reader.read<uint64_t>()};
+        uint64_t hash[2];
+        if (!reader.ok) {
+            return false;
+        }
+        hashRanges(ranges, hash);
+        if (hash[0] != storedHash[0] || hash[1] != storedHash[1]) {
+            return false;
+        }
+
+        DecodedTrack track;
+        track.trackNum = trackNum;
+        uint32_t trackErrors = reader.read<uint32_t>();
+        bool trackChangedPPQN = reader.read<bool>();
+        int16_t trackPPQN = reader.read<int16_t>();
+        DiagnosticLog trackDiagnostics;
+        trackDiagnostics.read(reader);
+        std::vector<uint8_t> selectedPrograms;
+        reader.readColumn(selectedPrograms, reader.read<uint32_t>());
+        reader.readColumn(track.programs, reader.read<uint32_t>());
+        track.lastProgramSlot = reader.read<uint8_t>();
+        size_t eventCount = reader.read<uint32_t>();
+        reader.readColumn(track.events.ticks, eventCount);
+        reader.readColumn(track.events.types, eventCount);
+        reader.readColumn(track.events.channels, eventCount);
+        reader.readColumn(track.events.data1, eventCount);
+        reader.readColumn(track.events.data2, eventCount);
+        if (!reader.ok || reader.position != entry.size()) {
+            return false;
+        }
+        // resolveChannels only has channels for the track's own slots
+        auto validSlot = [&track](uint8_t slot) { return slot == INHERITED_CHANNEL || slot < track.programs.size(); };
+        if (!validSlot(track.lastProgramSlot) ||
+            !std::all_of(track.events.channels.begin(), track.events.channels.end(), validSlot)) {
+            return false;
+        }
+
+        errorCount += trackErrors;
+        if (trackChangedPPQN) {
+            ppqn = trackPPQN;
+            ppqnChanged = true;
+        }
+        diagnostics.append(trackDiagnostics);
+        for (uint8_t program : selectedPrograms) {
+            trackInstruments.push_back(std::make_tuple(trackNum, program));
+        }
+        tracks.push_back(std::move(track));
+        cachedTracks++;
+        return true;
+    }
+
+    void storeCachedTrack(const std::string& key, const ByteRanges& ranges, uint32_t trackErrors,
+                          const DiagnosticLog& trackDiagnostics, size_t firstInstrument) {
+        EntryWriter entry;
+        entry.write(static_cast<uint32_t>(ranges.size()));
+        for (const auto& range : ranges) {
+            entry.write(range.first);
+            entry.write(range.second);
+        }
+        uint64_t hash[2];
+        hashRanges(ranges, hash);
+        entry.write(hash[0]);
+        entry.write(hash[1]);
+
+        entry.write(trackErrors);
+        entry.write(ppqnChanged); // Only this track's change, decodeTrack clears it first
+        entry.write(ppqn);
+        trackDiagnostics.write(entry);
+        entry.write(static_cast<uint32_t>(trackInstruments.size() - firstInstrument));
+        for (size_t i = firstInstrument; i < trackInstruments.size(); i++) {
+            entry.write(std::get<1>(trackInstruments[i]));
+        }
+        entry.write(static_cast<uint32_t>(decoded.programs.size()));
+        entry.writeColumn(decoded.programs);
+        entry.write(decoded.lastProgramSlot);
+        entry.write(static_cast<uint32_t>(decoded.events.size()));
+        entry.writeColumn(decoded.events.ticks);
+        entry.writeColumn(decoded.events.types);
+        entry.writeColumn(decoded.events.channels);
+        entry.writeColumn(decoded.events.data1);
+        entry.writeColumn(decoded.events.data2);
+
+        trackCache->store(key, entry.data);
+    }
+
+    /*Seek Index*/
+
+    /* Building an index records a checkpoint on the first wait past every CHECKPOINT_TICKS, once at least
+    CHECKPOINT_INSTRUCTIONS were decoded since the last one (resuming then never costs more than that, and
+    the index grows with the bytecode decoded rather than the song's length). A range conversion restores
+    the last one before the range. Jumps are the only place the visited bitmap is read, so a checkpoint
+    only needs which of the track's jump targets had been played by then, worked out once the track is
+    done from when each offset was first visited. */
+    static const uint32_t CHECKPOINT_TICKS = 8 * 120; // 8 quarters at the default PPQN, not the file's, tracks decoded
+                                                      // concurrently don't see the root track set it
+    static const uint32_t CHECKPOINT_INSTRUCTIONS = 1024;
+
+    bool buildingIndex = false;
+    const SeekIndex* seekIndex = nullptr;
+    uint32_t rangeStart = 0;
+    uint32_t rangeEnd = UINT32_MAX;
+    uint32_t nextTimeCheck = UINT32_MAX; // Waits reaching this call timeCheck, the next checkpoint or the range end
+    uint32_t nextCheckpoint = UINT32_MAX;
+
+    std::vector<uint32_t> firstVisits;      // Per byte of hexData, visitCount when the offset was first executed
+    uint32_t visitCount = 0;
+    std::vector<uint32_t> jumpTargets;
+    std::vector<uint32_t> checkpointVisits; // visitCount at each checkpoint
+    EventStream chasedControllers;
+    size_t chasedEvents = 0;
+    SeekIndex::TrackIndex trackIndex;       // Track being indexed
+
+    std::vector<SeekIndex::TrackIndex> indexedTracks;
+    std::vector<std::pair<uint32_t, uint32_t>> indexedTempos; // Tick, microseconds per quarter note, in track order
+    uint32_t indexedLength = 0;
+
+    // Folds event i into `controllers`, the last program/volume/pan/reverb/pitch bend set on each channel slot
+    static void chaseController(const EventStream& events, size_t i, EventStream& controllers) {
+        uint8_t type = events.types[i];
+        if (type != EV_PROGRAM && type != EV_VOLUME && type != EV_PAN && type != EV_REVERB && type != EV_PITCH_BEND) {
+            return;
+        }
+        for (size_t c = 0; c < controllers.size(); c++) {
+            if (controllers.types[c] == type && controllers.channels[c] == events.channels[i]) {
+                controllers.data1[c] = events.data1[i];
+                controllers.data2[c] = events.data2[i];
+                return;
+            }
+        }
+        controllers.push(0, static_cast<EventType>(type), events.channels[i], events.data1[i], events.data2[i]);
+    }
+
+    bool inRange() const {
+        return rangeStart > 0 || rangeEnd != UINT32_MAX;
+    }
+
+    // Called from waits, true when the range is over and decoding stops
+    bool timeCheck() {
+        if (accumulatedWaitTime >= rangeEnd) {
+            return true;
+        }
+        uint32_t lastVisits = checkpointVisits.empty() ? 0 : checkpointVisits.back();
+        if (accumulatedWaitTime >= nextCheckpoint && visitCount - lastVisits >= CHECKPOINT_INSTRUCTIONS) {
+            captureCheckpoint();
+        }
+        nextTimeCheck = std::min(nextCheckpoint, rangeEnd);
+        return false;
+    }
+
+    void captureCheckpoint() {
+        for (; chasedEvents < decoded.events.size(); chasedEvents++) {
+            chaseController(decoded.events, chasedEvents, chasedControllers);
+        }
+
+        SeekIndex::Checkpoint checkpoint;
+        checkpoint.tick = accumulatedWaitTime;
+        checkpoint.offset = curOffset;
+        checkpoint.channelSlot = channelSlot;
+        checkpoint.programCount = static_cast<uint16_t>(decoded.programs.size());
+        std::copy(std::begin(voiceToNote), std::end(voiceToNote), checkpoint.voiceToNote);
+        std::stack<StackFrame> frames = callStack;
+        checkpoint.returnOffsets.resize(frames.size());
+        for (size_t i = frames.size(); i > 0; i--) {
+            checkpoint.returnOffsets[i - 1] = frames.top().retOffset;
+            frames.pop();
+        }
+        checkpoint.controllers = chasedControllers;
+        trackIndex.checkpoints.push_back(std::move(checkpoint));
+        checkpointVisits.push_back(visitCount);
+
+        nextCheckpoint = (accumulatedWaitTime / CHECKPOINT_TICKS + 1) * CHECKPOINT_TICKS;
+    }
+
+    void beginTrackIndex() {
+        firstVisits.assign(hexData.size(), 0);
+        visitCount = 0;
+        nextCheckpoint = CHECKPOINT_TICKS;
+        nextTimeCheck = CHECKPOINT_TICKS;
+    }
+
+    void finishTrackIndex() {
+        std::sort(jumpTargets.begin(), jumpTargets.end());
+        jumpTargets.erase(std::unique(jumpTargets.begin(), jumpTargets.end()), jumpTargets.end());
+        for (size_t i = 0; i < trackIndex.checkpoints.size(); i++) {
+            for (uint32_t target : jumpTargets) {
+                if (firstVisits[target] != 0 && firstVisits[target] <= checkpointVisits[i]) {
+                    trackIndex.checkpoints[i].playedJumps.push_back(target);
+                }
+            }
+        }
+        trackIndex.programs = decoded.programs;
+        trackIndex.lastProgramSlot = decoded.lastProgramSlot;
+
+        for (size_t i = 0; i < decoded.events.size(); i++) {
+            if (decoded.events.types[i] == EV_TEMPO) {
+                indexedTempos.emplace_back(decoded.events.ticks[i], decoded.events.data1[i]);
+            }
+        }
+        if (!decoded.events.ticks.empty()) {
+            indexedLength = std::max(indexedLength, decoded.events.ticks.back());
+        }
+        indexedTracks.push_back(std::move(trackIndex));
+
+        trackIndex = SeekIndex::TrackIndex();
+        firstVisits.clear();
+        jumpTargets.clear();
+        checkpointVisits.clear();
+        chasedControllers = EventStream();
+        chasedEvents = 0;
+        nextCheckpoint = UINT32_MAX;
+        nextTimeCheck = UINT32_MAX;
+    }
+
+    // Fills in the index once every track is decoded
+    void finishSeekIndex(SeekIndex& index) {
+        index.version = converterVersion();
+        index.inputHash[0] = hashBytes(hexData.data(), hexData.size(), 0);
+        index.inputHash[1] = hashBytes(hexData.data(), hexData.size(), 1);
+        index.inputSize = hexData.size();
+        index.ppqn = static_cast<uint16_t>(ppqn);
+        index.lengthTicks = indexedLength;
+        index.tracks = std::move(indexedTracks);
+
+        // Like a MIDI player would, tempos of several tracks at one tick are applied in track order
+        std::stable_sort(indexedTempos.begin(), indexedTempos.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+        uint32_t ticksPerQuarter = std::max<uint32_t>(1, index.ppqn);
+        index.tempoMap.push_back({0, 500000, 0}); // 120 BPM until the first tempo
+        for (const auto& tempo : indexedTempos) {
+            SeekIndex::TempoSegment& last = index.tempoMap.back();
+            if (tempo.first == last.tick) {
+                last.tempo = tempo.second;
+            } else {
+                uint64_t microseconds = last.microseconds + uint64_t(tempo.first - last.tick) * last.tempo / ticksPerQuarter;
+                index.tempoMap.push_back({tempo.first, tempo.second, microseconds});
+            }
+        }
+    }
+
+    // Puts the decoder back in the state of a checkpoint, returns where decoding carries on
+    uint32_t resumeFrom(const SeekIndex::Checkpoint& checkpoint, const SeekIndex::TrackIndex& track) {
+        accumulatedWaitTime = checkpoint.tick;
+        channelSlot = checkpoint.channelSlot;
+        decoded.lastProgramSlot = checkpoint.channelSlot;
+        decoded.programs.assign(track.programs.begin(), track.programs.begin() + checkpoint.programCount);
+        std::copy(std::begin(checkpoint.voiceToNote), std::end(checkpoint.voiceToNote), voiceToNote);
+        for (uint32_t retOffset : checkpoint.returnOffsets) {
+            StackFrame frame = enterCall(retOffset);
+            frame.retOffset = retOffset;
+            frame.sideEffects = ~sideEffects; // Never cached, its events from before the checkpoint aren't decoded
+            callStack.push(frame);
+        }
+        for (uint32_t target : checkpoint.playedJumps) {
+            markVisited(target);
+        }
+        return checkpoint.offset;
+    }
+
+    // Keeps the events of [rangeStart, rangeEnd) moved to tick 0. Controllers set before the range are
+    // restated at its start, notes that started before it are left out along with their note offs
+    void clipToRange(EventStream controllers, size_t index) {
+        EventStream& events = decoded.events;
+        EventStream clipped;
+        size_t i = 0;
+        for (; i < events.size() && events.ticks[i] < rangeStart; i++) {
+            chaseController(events, i, controllers);
+        }
+
+        if (index == 0) {
+            // Tempo changes before the range could be on any track, the index knows the one in effect
+            clipped.push(0, EV_TEMPO, INHERITED_CHANNEL, seekIndex->tempoAt(rangeStart));
+        }
+        for (size_t c = 0; c < controllers.size(); c++) {
+            clipped.push(0, static_cast<EventType>(controllers.types[c]), controllers.channels[c], controllers.data1[c], controllers.data2[c]);
+        }
+
+        std::vector<uint8_t> sounding(256 * 128);
+        for (; i < events.size() && events.ticks[i] < rangeEnd; i++) {
+            uint8_t type = events.types[i];
+            uint8_t& count = sounding[events.channels[i] * 128 + (events.data1[i] & 0x7F)];
+            if (type == EV_NOTE_ON) {
+                count++;
+            } else if (type == EV_NOTE_OFF) {
+                if (count == 0) {
+                    continue;
+                }
+                count--;
+            }
+            clipped.push(events.ticks[i] - rangeStart, static_cast<EventType>(type), events.channels[i], events.data1[i], events.data2[i]);
+        }
+
+        events = std::move(clipped);
+        accumulatedWaitTime = std::clamp(accumulatedWaitTime, rangeStart, rangeEnd) - rangeStart;
+    }
+
+    /*Main Run*/
+
+    WorkStealingPool* trackPool = nullptr; // Decode tracks concurrently on this pool when set
+    GameDialect dialect = GameDialect::TwilightPrincess;
+
+    template <typename Dialect, bool Instrumented>
+    void decodeTracks() {
+        if (trackPool != nullptr && trackList.size() > 1) {
+            decodeTracksConcurrently<Dialect, Instrumented>();
+        } else {
+            for (size_t i = 0; i < trackList.size(); i++) {
+                decodeTrack<Dialect, Instrumented>(trackList[i], i);
+                if (midiWriter.sink != nullptr) {
+                    // Streaming, the track can be resolved and written before the next one is decoded
+                    resolveChannels();
+                    writeTracks();
+                }
+            }
+        }
+    }
+
+    template <typename Dialect, bool Instrumented>
+    void decodeTrack(const std::tuple<uint8_t, uint32_t>& track, size_t index) {
+        // Makes hexcode neater, but also prevents track 0's error code being 255
+        trackNum = (std::get<0>(track) == 0x00) ? std::get<0>(track) : (std::get<0>(track) - 1);
+        uint32_t trackStart = std::get<1>(track);
+        uint32_t resumeOffset = trackStart;
+
+        std::string cacheKey;
+        DiagnosticLog conversionDiagnostics;
+        uint32_t firstError = errorCount;
+        size_t firstInstrument = trackInstruments.size();
+        if (trackCache != nullptr) {
+            cacheKey = trackCacheKey(index, track);
+            if (loadCachedTrack(cacheKey)) {
+                firstTrack = false;
+                return;
+            }
+            // Kept apart for the cache entry, passed on once the track is done
+            conversionDiagnostics = std::exchange(diagnostics, diagnostics.fresh());
+        }
+        bool changedPPQN = ppqnChanged;
+        ppqnChanged = false;
+
+        visitedAddresses.resize((hexData.size() + 63) / 64);
+        if (renderingLoops()) {
+            loopMarks.resize(hexData.size());
+        }
+
+        decoded = DecodedTrack();
+        decoded.trackNum = trackNum;
+
+        if (!inRange()) {
+            // Assumes the track's code runs up to the next track's, roughly an event per two bytes of bytecode
+            uint32_t trackEnd = std::min<uint32_t>(entryFrom(trackStart + 1), static_cast<uint32_t>(hexData.size()));
+            decoded.events.reserve(trackEnd > trackStart ? (trackEnd - trackStart) / 2 : 0);
+        }
+
+        const SeekIndex::Checkpoint* resumed = nullptr;
+        if (inRange()) {
+            const SeekIndex::TrackIndex& indexed = seekIndex->tracks[index];
+            auto next = std::upper_bound(indexed.checkpoints.begin(), indexed.checkpoints.end(), rangeStart,
+                                         [](uint32_t tick, const SeekIndex::Checkpoint& checkpoint) { return tick < checkpoint.tick; });
+            if (next != indexed.checkpoints.begin()) {
+                resumed = &*(next - 1);
+                resumeOffset = resumeFrom(*resumed, indexed);
+            }
+            nextTimeCheck = rangeEnd;
+        } else if (buildingIndex) {
+            beginTrackIndex();
+        }
+
+        try {
+            parseEvents<Dialect, Instrumented>(trackStart, resumeOffset);
+        } catch (...) {
+            if (trackCache != nullptr) {
+                conversionDiagnostics.append(diagnostics);
+                diagnostics = std::move(conversionDiagnostics);
+            }
+            throw;
+        }
+        if (inRange()) {
+            clipToRange(resumed != nullptr ? resumed->controllers : EventStream(), index);
+            // Channels are handed out as in the whole song, programs selected after the range included
+            decoded.programs = seekIndex->tracks[index].programs;
+            decoded.lastProgramSlot = seekIndex->tracks[index].lastProgramSlot;
+        }
+        turnOffRemainingNotes();
+        if (buildingIndex) {
+            finishTrackIndex();
+        }
+
+        if (!pendingMarkers.empty()) {
+            std::stable_sort(pendingMarkers.begin(), pendingMarkers.end(),
+                             [](const auto& a, const auto& b) { return a.first < b.first; });
+            decoded.events.insertEvents(pendingMarkers);
+            pendingMarkers.clear();
+        }
+
+        if constexpr (Instrumented) {
+            if (collectStats) {
+                stats.tracks.push_back({trackNum, trackInstructions, decoded.events.size(), 0});
+                trackInstructions = 0;
+            }
+        }
+
+        if (trackCache != nullptr) {
+            storeCachedTrack(cacheKey, coveredRanges<Dialect>(), errorCount - firstError, diagnostics, firstInstrument);
+            conversionDiagnostics.append(diagnostics);
+            diagnostics = std::move(conversionDiagnostics);
+        }
+        ppqnChanged = ppqnChanged || changedPPQN;
+
+        tracks.push_back(std::move(decoded));
+        trackReset();
+    }
+
+    // Every track is decoded by its own parser, results are gathered in trackList order
+    // so the output is byte-identical to decoding them one after another
+    template <typename Dialect, bool Instrumented>
+    void decodeTracksConcurrently() {
+        std::vector<TrackParser> trackParsers(trackList.size());
+        std::vector<std::exception_ptr> failures(trackList.size());
+        std::atomic<size_t> remaining{trackList.size()};
+
+        for (size_t i = 0; i < trackList.size(); i++) {
+            TrackParser& track = trackParsers[i];
+            track.hexData = hexData;
+            track.paddedInput = paddedInput;
+            track.trackEntries = trackEntries;
+            track.diagnostics = diagnostics.fresh();
+            track.firstTrack = (i == 0) && firstTrack;
+            track.dialect = dialect;
+            track.loopCount = loopCount;
+            track.loopMarkers = loopMarkers;
+            track.collectStats = collectStats;
+            if (disassembly.enabled) {
+                track.disassembly.begin(nullptr, disassembly.json); // Collected, written out in track order below
+            }
+            track.trackCache = trackCache;
+            track.buildingIndex = buildingIndex;
+            track.seekIndex = seekIndex;
+            track.rangeStart = rangeStart;
+            track.rangeEnd = rangeEnd;
+
+            trackPool->submit([this, &track, &failures, &remaining, i] {
+                try {
+                    track.decodeTrack<Dialect, Instrumented>(trackList[i], i);
+                } catch (...) {
+                    failures[i] = std::current_exception();
+                }
+                remaining--;
+            });
+        }
+        trackPool->waitFor(remaining);
+
+        for (size_t i = 0; i < trackParsers.size(); i++) {
+            TrackParser& track = trackParsers[i];
+            diagnostics.append(track.diagnostics);
+            errorCount += track.errorCount;
+            if (failures[i]) {
+                std::rethrow_exception(failures[i]);
+            }
+
+            tracks.push_back(std::move(track.tracks.front()));
+            trackInstruments.insert(trackInstruments.end(), track.trackInstruments.begin(), track.trackInstruments.end());
+            cachedTracks += track.cachedTracks;
+            if (buildingIndex) {
+                indexedTracks.push_back(std::move(track.indexedTracks.front()));
+                indexedTempos.insert(indexedTempos.end(), track.indexedTempos.begin(), track.indexedTempos.end());
+                indexedLength = std::max(indexedLength, track.indexedLength);
+            }
+            if (disassembly.enabled) {
+                track.disassembly.flush();
+                disassembly.write(track.disassembly.collected);
+            }
+            if constexpr (Instrumented) {
+                for (size_t op = 0; op < stats.opcodeCounts.size(); op++) {
+                    stats.opcodeCounts[op] += track.stats.opcodeCounts[op];
+                }
+                stats.tracks.insert(stats.tracks.end(), track.stats.tracks.begin(), track.stats.tracks.end());
+            }
+            if (track.ppqnChanged) {
+                ppqn = track.ppqn;
+                ppqnChanged = true;
+            }
+        }
+        firstTrack = false;
+    }
+
+    using Clock = std::chrono::steady_clock;
+    ConversionTimings timings;
+
+    static double secondsSince(Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    size_t writtenTracks = 0;
+    size_t writtenEvents = 0;
+    double writeSeconds = 0; // Time spent writing tracks, streaming does some of it while decoding
+
+    // Writes out the decoded tracks and frees them
+    void writeTracks() {
+        Clock::time_point start = Clock::now();
+        for (auto& track : tracks) {
+            size_t chunkSize = midiWriter.writeTrack(track.events);
+            if (collectStats) {
+                stats.tracks[writtenTracks].midiBytes = chunkSize;
+            }
+            writtenTracks++;
+            writtenEvents += track.events.size();
+            if (keepEvents) {
+                keptEvents.push_back(std::move(track.events));
+            }
+        }
+        tracks.clear();
+        writeSeconds += secondsSince(start);
+    }
+
+    bool keepEvents = false;             // Hand the written tracks' events back (for rendering)
+    std::vector<EventStream> keptEvents;
+
+    void writeMIDIFile() {
+        if (midiWriter.sink == nullptr) {
+            // MIDI output usually runs a few times the size of the BMS, avoid regrowing for every track
+            midiWriter.midiData.reserve(hexData.size() * 4);
+            midiWriter.beginMIDIFile(trackList.size(), ppqn);
+        }
+        writeTracks();
+        midiWriter.handleMIDIHeader(trackList.size(), ppqn); // Fill in header
+    }
+
+    // Decodes every track of trackList and maps their programs to channels
+    void decode() {
+        // The only runtime dialect (and instrumentation) check, everything below is instantiated per dialect
+        switch (dialect) {
+            case GameDialect::TwilightPrincess:
+                if (collectStats || disassembly.enabled) {
+                    decodeTracks<TwilightPrincess, true>();
+                } else {
+                    decodeTracks<TwilightPrincess, false>();
+                }
+                break;
+        }
+
+        resolveChannels();
+    }
+
+    // Runs a whole conversion. With midiOut the MIDI file is streamed into it, only the track being written is
+    // held as MIDI (all of them with a track pool), otherwise it's built up in midiWriter.midiData
+    void convert(std::ostream* midiOut) {
+        Clock::time_point start = Clock::now();
+        getTrackPointers();
+        timings.trackPointers = secondsSince(start);
+
+        // std::cout << "Track List:" << std::endl;
+        // for (const auto& track : trackList) {
+        //     std::cout << "Track No: " << static_cast<int>(std::get<0>(track))
+        //               << ", Track Start: " << static_cast<int>(std::get<1>(track)) << std::endl;
+        // }
+
+        if (midiOut != nullptr) {
+            midiWriter.sink = midiOut;
+            midiWriter.beginMIDIFile(trackList.size(), ppqn);
+        }
+
+        start = Clock::now();
+        decode();
+        double streamedSeconds = writeSeconds;
+        timings.decode = secondsSince(start) - streamedSeconds;
+
+        start = Clock::now();
+        writeMIDIFile();
+        timings.midi = secondsSince(start) + streamedSeconds;
+    }
+};
+
+// BMS files are padded with zeros at the end, the padding is left out of the span
+ByteSpan trimPadding(const unsigned char* data, size_t size) {
+    while (size > 0 && data[size - 1] == 0x00) {
+        size--;
+    }
+    return ByteSpan(data, size);
+}
+
+/*Library API*/
+
+static ConversionResult runConversion(const uint8_t* bms, size_t size, const ConversionOptions& options, std::ostream* midiOut) {
+    ConversionResult result;
+    result.inputBytes = size;
+    TrackParser parser;
+    parser.diagnostics.minimumSeverity = options.minimumSeverity;
+    parser.diagnostics.repeatLimit = options.diagnosticRepeats;
+    parser.trackPool = options.trackPool;
+    parser.loopCount = std::max<uint32_t>(1, options.loopCount);
+    parser.loopMarkers = options.loopMarkers;
+    parser.collectStats = options.collectStats;
+    if (options.disassembly != nullptr) {
+        parser.disassembly.begin(options.disassembly, options.disassemblyJSON);
+    }
+    parser.keepEvents = options.keepEvents;
+    parser.midiWriter.runningStatus = options.runningStatus;
+    parser.midiWriter.noteOffsAsNoteOns = options.noteOffsAsNoteOns;
+    parser.midiWriter.dropRedundantEvents = options.dropRedundantEvents;
+    parser.hexData = trimPadding(bms, size);
+    parser.paddedInput = parser.hexData.size() < size;
+    parser.buildingIndex = options.buildSeekIndex;
+    parser.seekIndex = options.seekIndex;
+    parser.rangeStart = options.rangeStart;
+    parser.rangeEnd = options.rangeEnd;
+    // Stats and disassembly cover what was actually decoded, indexes and ranges need the decoder's state
+    bool decodeAll = options.collectStats || options.disassembly != nullptr || options.buildSeekIndex || parser.inRange();
+    parser.trackCache = decodeAll ? nullptr : options.trackCache;
+
+    if (parser.hexData.empty()) {
+        result.failure = "BMS file is empty";
+        return result;
+    }
+    if ((options.buildSeekIndex || parser.inRange()) && parser.renderingLoops()) {
+        result.failure = "Seek indexes and ranges can't be combined with loop rendering";
+        return result;
+    }
+    if (parser.inRange()) {
+        if (options.rangeStart >= options.rangeEnd) {
+            result.failure = "The range is empty";
+            return result;
+        }
+        if (options.seekIndex == nullptr || !options.seekIndex->matches(bms, size)) {
+            result.failure = "A range needs a seek index of this file";
+            return result;
+        }
+        parser.ppqn = static_cast<int16_t>(options.seekIndex->ppqn); // The header's, a checkpoint may be past the change
+    }
+
+    try {
+        parser.convert(midiOut);
+        if (options.buildSeekIndex) {
+            parser.finishSeekIndex(result.seekIndex);
+        }
+        if (midiOut != nullptr && !*midiOut) {
+            result.failure = "Failed to write the MIDI file";
+        } else {
+            result.midiBytes = parser.midiWriter.flushedBytes + parser.midiWriter.midiData.size();
+            result.midi = std::move(parser.midiWriter.midiData);
+            result.ok = true;
+        }
+    } catch (const std::exception& e) {
+        result.failure = e.what();
+    }
+    parser.disassembly.flush(); // Up to where decoding stopped when it failed
+
+    result.diagnostics = parser.diagnostics.report();
+    result.suppressedDiagnostics = parser.diagnostics.suppressed();
+    result.diagnosticRecords = std::move(parser.diagnostics.records);
+    result.errorCount = parser.errorCount;
+    result.trackCount = parser.trackList.size();
+    result.eventCount = parser.writtenEvents;
+    result.cachedTracks = parser.cachedTracks;
+    result.ppqn = static_cast<uint16_t>(parser.ppqn);
+    result.events = std::move(parser.keptEvents);
+    result.trackInstruments = std::move(parser.trackInstruments);
+    result.timings = parser.timings;
+    result.stats = std::move(parser.stats);
+    return result;
+}
+
+ConversionResult convertBMS(const uint8_t* bms, size_t size, const ConversionOptions& options) {
+    return runConversion(bms, size, options, nullptr);
+}
+
+ConversionResult convertBMS(const uint8_t* bms, size_t size, const ConversionOptions& options, std::ostream& midiOut) {
+    return runConversion(bms, size, options, &midiOut);
+}
+
+/*Seek Index*/
+
+uint64_t SeekIndex::microsecondsAt(uint32_t tick) const {
+    if (tempoMap.empty()) {
+        return 0;
+    }
+    auto next = std::upper_bound(tempoMap.begin(), tempoMap.end(), tick,
+                                 [](uint32_t value, const TempoSegment& segment) { return value < segment.tick; });
+    const TempoSegment& segment = *(next - 1);
+    return segment.microseconds + uint64_t(tick - segment.tick) * segment.tempo / std::max<uint32_t>(1, ppqn);
+}
+
+uint32_t SeekIndex::tickAt(uint64_t microseconds) const {
+    if (tempoMap.empty()) {
+        return 0;
+    }
+    auto next = std::upper_bound(tempoMap.begin(), tempoMap.end(), microseconds,
+                                 [](uint64_t value, const TempoSegment& segment) { return value < segment.microseconds; });
+    const TempoSegment& segment = *(next - 1);
+    uint64_t ticks = (microseconds - segment.microseconds) * std::max<uint32_t>(1, ppqn) / std::max<uint32_t>(1, segment.tempo);
+    return static_cast<uint32_t>(std::min<uint64_t>(segment.tick + ticks, UINT32_MAX));
+}
+
+uint32_t SeekIndex::tempoAt(uint32_t tick) const {
+    if (tempoMap.empty()) {
+        return 500000;
+    }
+    auto next = std::upper_bound(tempoMap.begin(), tempoMap.end(), tick,
+                                 [](uint32_t value, const TempoSegment& segment) { return value < segment.tick; });
+    return (next - 1)->tempo;
+}
+
+bool SeekIndex::matches(const uint8_t* bms, size_t size) const {
+    ByteSpan data = trimPadding(bms, size);
+    return !empty() && version == converterVersion() && inputSize == data.size() &&
+           inputHash[0] == hashBytes(data.data(), data.size(), 0) && inputHash[1] == hashBytes(data.data(), data.size(), 1);
+}
+
+// Stored like track cache entries, an index is only read back by the build that wrote it
+std::string SeekIndex::serialize() const {
+    EntryWriter writer;
+    writer.writeString("BMSSEEK");
+    writer.writeString(version);
+    writer.write(inputHash[0]);
+    writer.write(inputHash[1]);
+    writer.write(static_cast<uint64_t>(inputSize));
+    writer.write(ppqn);
+    writer.write(lengthTicks);
+    writer.write(static_cast<uint32_t>(tempoMap.size()));
+    writer.writeColumn(tempoMap);
+
+    writer.write(static_cast<uint32_t>(tracks.size()));
+    for (const auto& track : tracks) {
+        writer.write(static_cast<uint32_t>(track.programs.size()));
+        writer.writeColumn(track.programs);
+        writer.write(track.lastProgramSlot);
+        writer.write(static_cast<uint32_t>(track.checkpoints.size()));
+        for (const auto& checkpoint : track.checkpoints) {
+            writer.write(checkpoint.tick);
+            writer.write(checkpoint.offset);
+            writer.write(checkpoint.channelSlot);
+            writer.write(checkpoint.programCount);
+            writer.write(checkpoint.voiceToNote);
+            writer.write(static_cast<uint32_t>(checkpoint.returnOffsets.size()));
+            writer.writeColumn(checkpoint.returnOffsets);
+            writer.write(static_cast<uint32_t>(checkpoint.playedJumps.size()));
+            writer.writeColumn(checkpoint.playedJumps);
+            const EventStream& controllers = checkpoint.controllers;
+            writer.write(static_cast<uint32_t>(controllers.size()));
+            writer.writeColumn(controllers.ticks);
+            writer.writeColumn(controllers.types);
+            writer.writeColumn(controllers.channels);
+            writer.writeColumn(controllers.data1);
+            writer.writeColumn(controllers.data2);
+        }
+    }
+    return writer.data;
+}
+
+bool SeekIndex::deserialize(const std::string& data) {
+    *this = SeekIndex();
+    SeekIndex index;
+    EntryReader reader(data);
+    if (reader.readString() != "BMSSEEK") {
+        return false;
+    }
+    index.version = reader.readString();
+    index.inputHash[0] = reader.read<uint64_t>();
+    index.inputHash[1] = reader.read<uint64_t>();
+    index.inputSize = static_cast<size_t>(reader.read<uint64_t>());
+    index.ppqn = reader.read<uint16_t>();
+    index.lengthTicks = reader.read<uint32_t>();
+    reader.readColumn(index.tempoMap, reader.read<uint32_t>());
+
+    // Each track takes at least its two counts and lastProgramSlot, each checkpoint its fixed fields and counts
+    index.tracks.resize(reader.readCount(2 * sizeof(uint32_t) + 1));
+    for (auto& track : index.tracks) {
+        reader.readColumn(track.programs, reader.read<uint32_t>());
+        track.lastProgramSlot = reader.read<uint8_t>();
+        track.checkpoints.resize(reader.readCount(2 * sizeof(uint32_t) + 3 + 8 + 3 * sizeof(uint32_t)));
+        for (auto& checkpoint : track.checkpoints) {
+            checkpoint.tick = reader.read<uint32_t>();
+            checkpoint.offset = reader.read<uint32_t>();
+            checkpoint.channelSlot = reader.read<uint8_t>();
+            checkpoint.programCount = reader.read<uint16_t>();
+            reader.take(checkpoint.voiceToNote, sizeof(checkpoint.voiceToNote));
+            reader.readColumn(checkpoint.returnOffsets, reader.read<uint32_t>());
+            reader.readColumn(checkpoint.playedJumps, reader.read<uint32_t>());
+            EventStream& controllers = checkpoint.controllers;
+            size_t count = reader.read<uint32_t>();
+            reader.readColumn(controllers.ticks, count);
+            reader.readColumn(controllers.types, count);
+            reader.readColumn(controllers.channels, count);
+            reader.readColumn(controllers.data1, count);
+            reader.readColumn(controllers.data2, count);
+            if (!reader.ok || checkpoint.programCount > track.programs.size()) {
+                return false;
+            }
+            // Restored slots have to be among the programs selected by then
+            auto validSlot = [&checkpoint](uint8_t slot) { return slot == INHERITED_CHANNEL || slot < checkpoint.programCount; };
+            if (!validSlot(checkpoint.channelSlot) ||
+                !std::all_of(controllers.channels.begin(), controllers.channels.end(), validSlot)) {
+                return false;
+            }
+        }
+        if (!reader.ok || (track.lastProgramSlot != INHERITED_CHANNEL && track.lastProgramSlot >= track.programs.size())) {
+            return false;
+        }
+    }
+    if (!reader.ok || reader.position != data.size() || index.tempoMap.empty() || index.version != converterVersion()) {
+        return false;
+    }
+    *this = std::move(index);
+    return true;
+}
+
+/*Diagnostics*/
+
+Severity diagnosticSeverity(DiagnosticCode code) {
+    return diagnosticInfo[static_cast<size_t>(code)].severity;
+}
+
+std::string formatDiagnostic(const Diagnostic& diagnostic) {
+    const uint8_t* bytes = diagnostic.bytes;
+    int32_t value = diagnostic.value;
+    char problem[160] = "";
+    switch (diagnostic.code) {
+        case DiagnosticCode::BadNoteVoice:
+            std::snprintf(problem, sizeof(problem), "note 0x%02x has voice 0x%02x, voices are 1-8", bytes[0], bytes[1]);
+            break;
+        case DiagnosticCode::UnknownOpcode:
+            std::snprintf(problem, sizeof(problem), "unknown opcode 0x%02x after 0x%02x, the track ends here", bytes[0], bytes[1]);
+            break;
+        case DiagnosticCode::UnknownInitialByte:
+            std::snprintf(problem, sizeof(problem), "unknown byte 0x%02x, the initial track isn't fully deciphered yet so the rest is still converted", bytes[0]);
+            break;
+        case DiagnosticCode::UnknownPerfType:
+            std::snprintf(problem, sizeof(problem), "SET_PERF with unknown type 0x%02x, value %d", bytes[0], static_cast<int>(value));
+            break;
+        case DiagnosticCode::UnusualEffect:
+            std::snprintf(problem, sizeof(problem), "effect parameter 0x%02x is %d instead of 0", bytes[0], static_cast<int>(value));
+            break;
+        case DiagnosticCode::BadVoiceOff:
+            std::snprintf(problem, sizeof(problem), "voice off for voice 0x%02x, voices are 1-8", bytes[0]);
+            break;
+        case DiagnosticCode::TooManyChannels:
+            std::snprintf(problem, sizeof(problem), "program 0x%02x would need channel %d, there are only 16", bytes[0], static_cast<int>(value) + 1);
+            break;
+        case DiagnosticCode::TrackPastEnd:
+            std::snprintf(problem, sizeof(problem), "the track runs past the end of the file (0x%x bytes)", static_cast<unsigned>(value));
+            break;
+        case DiagnosticCode::TruncatedInstruction:
+            std::snprintf(problem, sizeof(problem), "the file (0x%x bytes) ends in the middle of opcode 0x%02x", static_cast<unsigned>(value), bytes[0]);
+            break;
+    }
+
+    char line[224];
+    if (diagnostic.code == DiagnosticCode::TooManyChannels) {
+        std::snprintf(line, sizeof(line), "%s: track %d: %s", severityName(diagnosticSeverity(diagnostic.code)),
+                      diagnostic.trackNum, problem);
+    } else {
+        std::snprintf(line, sizeof(line), "%s: track %d at 0x%x: %s", severityName(diagnosticSeverity(diagnostic.code)),
+                      diagnostic.trackNum, static_cast<unsigned>(diagnostic.offset), problem);
+    }
+    return line;
+}
+
+const char* opcodeName(uint8_t opcode) {
+    return TwilightPrincess::opcodes[opcode].name;
+}
+
+uint64_t hashBytes(const uint8_t* data, size_t size, uint64_t seed) {
+    const uint64_t prime = 0x9E3779B97F4A7C15ull;
+    uint64_t hash = seed ^ (size * prime);
+
+    // Eight bytes a step, the tail is zero extended
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        hash ^= word * prime;
+        hash = ((hash << 31) | (hash >> 33)) * 0xBF58476D1CE4E5B9ull;
+    }
+    uint64_t tail = 0;
+    if (i < size) {
+        std::memcpy(&tail, data + i, size - i);
+    }
+    hash ^= tail * prime;
+
+    // Finalizer so every input bit reaches every output bit
+    hash ^= hash >> 30;
+    hash *= 0xBF58476D1CE4E5B9ull;
+    hash ^= hash >> 27;
+    hash *= 0x94D049BB133111EBull;
+    hash ^= hash >> 31;
+    return hash;
+}
+
+/* Bump CONVERTER_FORMAT whenever the converter's output for some input changes (decoder, MIDI writer) or the
+layout of track cache entries or seek indexes does, so entries written before aren't reused. Rebuilding the
+same source keeps the caches. */
+static const int CONVERTER_FORMAT = 1;
+
+const char* converterVersion() {
+    static const std::string version = "bmsconverter " + std::to_string(CONVERTER_FORMAT);
+    return version.c_str();
+}
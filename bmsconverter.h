@@ -0,0 +1,204 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "eventstream.h"
+
+/* BMS to MIDI conversion library. A conversion only touches the buffers it's handed, there's no global
+state, file access or console output, so any number of them can run at once from different threads. */
+
+// Building or using the shared library on Windows needs the symbols exported/imported,
+// with gcc only the API stays visible when the library is built with -fvisibility=hidden
+#if defined(_WIN32) && defined(BMSCONVERTER_SHARED)
+#ifdef BMSCONVERTER_EXPORTS
+#define BMS_API __declspec(dllexport)
+#else
+#define BMS_API __declspec(dllimport)
+#endif
+#elif defined(__GNUC__)
+#define BMS_API __attribute__((visibility("default")))
+#else
+#define BMS_API
+#endif
+
+class WorkStealingPool;
+
+/* Per-track decode cache, supplied by the host (bmsanalyzer keeps one on disk). Entries carry the bytecode
+ranges the track was decoded from, so a track is only reused while those bytes are unchanged. Called from
+several threads at once when tracks are decoded on a pool. */
+class TrackCache {
+public:
+    virtual ~TrackCache() = default;
+    virtual bool load(const std::string& key, std::string& entry) = 0;
+    virtual void store(const std::string& key, const std::string& entry) = 0;
+};
+
+/* Seek index of one .bms file, built by a full conversion (ConversionOptions::buildSeekIndex) and kept by the
+host next to the file. Holds the tempo map, for going between ticks and time in O(log n), and checkpoints
+of every track's decoder state every few bars, so converting a range starts decoding each track at the
+last checkpoint before it instead of at the start of the song. */
+class SeekIndex {
+public:
+    struct TempoSegment {
+        uint32_t tick;
+        uint32_t tempo;            // Microseconds per quarter note from tick on
+        uint64_t microseconds;     // Time at tick
+    };
+
+    // Decoder state of a track after a wait, enough to carry on decoding from there
+    struct Checkpoint {
+        uint32_t tick = 0;
+        uint32_t offset = 0;                  // Next instruction
+        uint8_t channelSlot = 0;
+        uint16_t programCount = 0;            // Programs selected so far, a prefix of TrackIndex::programs
+        uint8_t voiceToNote[8] = {};
+        std::vector<uint32_t> returnOffsets;  // Call stack, outermost call first
+        std::vector<uint32_t> playedJumps;    // The track's jump targets already played, jumps only follow unplayed ones
+        EventStream controllers;              // Last program, volume, pan, reverb and pitch per channel slot
+    };
+
+    struct TrackIndex {
+        std::vector<uint8_t> programs;        // Every program the track selects, in slot order
+        uint8_t lastProgramSlot = 0;
+        std::vector<Checkpoint> checkpoints;  // Ascending ticks
+    };
+
+    uint16_t ppqn = 0;
+    uint32_t lengthTicks = 0;
+    std::vector<TempoSegment> tempoMap;      // Ascending ticks, starts at tick 0
+    std::vector<TrackIndex> tracks;          // In track order
+
+    bool empty() const {
+        return tempoMap.empty();
+    }
+
+    BMS_API uint64_t microsecondsAt(uint32_t tick) const;
+    BMS_API uint32_t tickAt(uint64_t microseconds) const;
+    BMS_API uint32_t tempoAt(uint32_t tick) const;
+
+    // Built from exactly these bytes by this converter build
+    BMS_API bool matches(const uint8_t* bms, size_t size) const;
+
+    BMS_API std::string serialize() const;
+    BMS_API bool deserialize(const std::string& data); // False (and left empty) when it isn't a valid index of this build
+
+private:
+    friend struct TrackParser;
+    std::string version;
+    uint64_t inputHash[2] = {};
+    size_t inputSize = 0;
+};
+
+enum class Severity : uint8_t {
+    Notice,
+    Error,       // Counted in ConversionResult::errorCount
+};
+
+// What went wrong, and what a Diagnostic's bytes and value hold for it
+enum class DiagnosticCode : uint8_t {
+    BadNoteVoice,          // Error, the conversion fails. bytes: note, voice
+    UnknownOpcode,         // Error, the track ends there. bytes: opcode, previous byte
+    UnknownInitialByte,    // Notice, the initial track ends there but the rest is converted. bytes: opcode
+    UnknownPerfType,       // Error. bytes: parameter type, value: parameter value
+    UnusualEffect,         // Notice, effect parameter 0x04 that isn't 0. bytes: parameter type, value: parameter value
+    BadVoiceOff,           // Error. bytes: voice
+    TooManyChannels,       // Error, more than 16 programs, found after decoding so offset is 0. bytes: program, value: channel it would get
+    TrackPastEnd,          // Error, the track ends there. value: file size
+    TruncatedInstruction,  // Error, the track ends there. bytes: opcode, value: file size
+};
+
+// One decode problem, recorded as it happens and only turned into text for the report
+struct Diagnostic {
+    DiagnosticCode code;
+    uint8_t trackNum;
+    uint8_t bytes[2];
+    uint32_t offset;       // Instruction the problem is in
+    int32_t value;
+};
+
+BMS_API Severity diagnosticSeverity(DiagnosticCode code);
+
+// One line of text, without the newline
+BMS_API std::string formatDiagnostic(const Diagnostic& diagnostic);
+
+struct ConversionOptions {
+    uint32_t loopCount = 1;                 // Times every loop is played, 1 drops the jump back
+    bool loopMarkers = false;               // Surround the first pass of every loop with loopStart/loopEnd markers
+    WorkStealingPool* trackPool = nullptr;  // Decode the tracks concurrently on this pool when set (workstealingpool.h)
+    bool collectStats = false;              // Fill in ConversionResult::stats, costs nothing when off
+    TrackCache* trackCache = nullptr;       // Reuse unchanged tracks from earlier conversions, not used with stats
+    bool keepEvents = false;                // Fill in ConversionResult::events, for rendering
+    bool buildSeekIndex = false;            // Fill in ConversionResult::seekIndex, not with loop rendering
+    const SeekIndex* seekIndex = nullptr;   // Index of the file being converted, needed for a range
+    uint32_t rangeStart = 0;                // Only convert ticks [rangeStart, rangeEnd), moved to start at tick 0
+    uint32_t rangeEnd = UINT32_MAX;
+    std::ostream* disassembly = nullptr;    // Write a line here for every decoded instruction, skips the track cache
+    bool disassemblyJSON = false;           // JSON lines instead of text
+    Severity minimumSeverity = Severity::Notice; // Diagnostics below this aren't kept
+    uint32_t diagnosticRepeats = 10;        // Kept per code and track, later ones are only counted (0 keeps all)
+    bool runningStatus = true;              // Leave out status bytes repeating the track's previous channel event's
+    bool noteOffsAsNoteOns = false;         // Note-offs as velocity 0 note-ons, so they share running status with the note-ons
+    bool dropRedundantEvents = false;       // Leave out volume/pan/reverb/pitch bend events repeating the track's last value
+                                            // on the channel, tracks sharing a channel can undo each other's with it
+};
+
+// Seconds spent in each phase of the conversion
+struct ConversionTimings {
+    double trackPointers = 0;
+    double decode = 0;
+    double midi = 0;
+};
+
+struct TrackStats {
+    uint8_t trackNum = 0;
+    uint64_t instructions = 0; // Instructions decoded, replayed subroutine calls and loop passes aren't decoded again
+    uint64_t events = 0;       // Events emitted into the track
+    uint64_t midiBytes = 0;    // Size of the track's MTrk chunk
+};
+
+struct ConversionStats {
+    std::array<uint64_t, 256> opcodeCounts{}; // Times parseEvents ran each opcode byte, see opcodeName()
+    std::vector<TrackStats> tracks;
+};
+
+struct ConversionResult {
+    bool ok = false;
+    std::string failure;        // Why the sequence couldn't be converted
+    std::vector<uint8_t> midi;  // The MIDI file, left empty when it was streamed
+    std::string diagnostics;    // Report of the diagnostics, one per line and a count of the repeats left out
+    std::vector<Diagnostic> diagnosticRecords; // Kept diagnostics, in track order
+    uint32_t suppressedDiagnostics = 0;        // Repeats past ConversionOptions::diagnosticRepeats
+    uint32_t errorCount = 0;    // Decode errors, the MIDI file is still written with them
+    size_t inputBytes = 0;
+    size_t trackCount = 0;
+    size_t eventCount = 0;
+    size_t midiBytes = 0;       // Size of the MIDI file, also when it was streamed
+    size_t cachedTracks = 0;    // Tracks taken from the track cache instead of being decoded
+    uint16_t ppqn = 0;
+    std::vector<EventStream> events; // Every track's events with channels resolved, only with keepEvents
+    std::vector<std::tuple<uint8_t, uint8_t>> trackInstruments; // [trackNum, program] in the order they're selected
+    ConversionTimings timings;
+    ConversionStats stats;      // Only filled in with ConversionOptions::collectStats
+    SeekIndex seekIndex;        // Only filled in with ConversionOptions::buildSeekIndex
+};
+
+// Converts the bytes of a .bms file into a MIDI file in memory
+BMS_API ConversionResult convertBMS(const uint8_t* bms, size_t size, const ConversionOptions& options = ConversionOptions());
+
+// Same, but the MIDI file is written to `midiOut` a track at a time, so memory stays bounded by the largest track
+BMS_API ConversionResult convertBMS(const uint8_t* bms, size_t size, const ConversionOptions& options, std::ostream& midiOut);
+
+// Name of an opcode byte in the converted dialect, for reporting opcode counts
+BMS_API const char* opcodeName(uint8_t opcode);
+
+// Fast non-cryptographic hash, for cache keys
+BMS_API uint64_t hashBytes(const uint8_t* data, size_t size, uint64_t seed = 0);
+
+// Identifies the converter's output and entry formats, cached conversions and seek indexes of another version aren't reused
+BMS_API const char* converterVersion();
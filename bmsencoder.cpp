@@ -0,0 +1,701 @@
+#include "bmsencoder.h"
+#include "eventstream.h"
+#include "mml.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <deque>
+#include <initializer_list>
+#include <unordered_map>
+#include <utility>
+
+/* MIDI to BMS encoder
+
+The MIDI file is read into lanes, the events of one channel in one MIDI track. Each lane becomes a BMS
+track, or more than one when it plays more than 7 notes at once, first as timed instructions and then
+as one run of instructions with the waits in between. Repeats are searched for on the runs of all tracks
+together: every window of `minimumRun` instructions is hashed with a rolling hash, a window seen before
+is extended for as long as both copies keep matching and becomes a subroutine that both places CALL.
+Later copies of a subroutine's run just CALL it. The file is laid out last, the root track (OPEN_TRACKs,
+ppqn and tempo changes) first, then the tracks and the subroutines after them.
+
+ */
+
+namespace {
+
+/*MIDI Reading*/
+
+const uint8_t TEMPO_EVENT = 0xFF;
+
+struct MidiEvent {
+    uint32_t tick;
+    uint32_t tempo;   // Microseconds per quarter note, for TEMPO_EVENT
+    uint8_t status;   // Event type in the high nibble and the channel in the low one, or TEMPO_EVENT
+    uint8_t data1;
+    uint8_t data2;
+};
+
+struct MidiTrack {
+    std::vector<MidiEvent> events;
+    uint32_t endTick = 0;
+};
+
+struct MidiFile {
+    uint16_t ppqn = 0;
+    std::vector<MidiTrack> tracks;
+    size_t droppedEvents = 0; // Sysex
+};
+
+uint16_t readBE16(const uint8_t* data) {
+    return static_cast<uint16_t>((data[0] << 8) | data[1]);
+}
+
+uint32_t readBE32(const uint8_t* data) {
+    return (static_cast<uint32_t>(data[0]) << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+bool readVLQ(const uint8_t*& p, const uint8_t* end, uint32_t& value) {
+    value = 0;
+    for (int i = 0; i < 4; i++) {
+        if (p >= end) {
+            return false;
+        }
+        uint8_t c = *p++;
+        value = (value << 7) | (c & 0x7F);
+        if (!(c & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool readTrack(const uint8_t* p, const uint8_t* end, MidiFile& file, std::string& failure) {
+    MidiTrack track;
+    uint32_t tick = 0;
+    uint8_t running = 0;
+
+    while (p < end) {
+        uint32_t delta;
+        if (!readVLQ(p, end, delta) || p >= end) {
+            failure = "A MIDI track ends in the middle of an event";
+            return false;
+        }
+        tick += delta;
+
+        uint8_t status = *p;
+        if (status & 0x80) {
+            p++;
+            if (status < 0xF0) {
+                running = status;
+            }
+        } else if (running != 0) {
+            status = running;
+        } else {
+            failure = "A MIDI track uses running status without a status byte";
+            return false;
+        }
+
+        if (status == 0xFF) {
+            uint32_t length;
+            if (p >= end) {
+                failure = "A MIDI track ends in the middle of an event";
+                return false;
+            }
+            uint8_t type = *p++;
+            if (!readVLQ(p, end, length) || length > static_cast<size_t>(end - p)) {
+                failure = "A MIDI track ends in the middle of an event";
+                return false;
+            }
+            if (type == 0x51 && length == 3) {
+                track.events.push_back({tick, (static_cast<uint32_t>(p[0]) << 16) | (p[1] << 8) | p[2], TEMPO_EVENT, 0, 0});
+            }
+            p += length;
+            if (type == 0x2F) {
+                break;
+            }
+            continue;
+        }
+        if (status == 0xF0 || status == 0xF7) {
+            uint32_t length;
+            if (!readVLQ(p, end, length) || length > static_cast<size_t>(end - p)) {
+                failure = "A MIDI track ends in the middle of an event";
+                return false;
+            }
+            p += length;
+            running = 0;
+            file.droppedEvents++;
+            continue;
+        }
+        if (status > 0xF0) {
+            failure = "A MIDI track has a system message that doesn't belong in a file";
+            return false;
+        }
+
+        size_t dataLength = ((status & 0xF0) == 0xC0 || (status & 0xF0) == 0xD0) ? 1 : 2;
+        if (static_cast<size_t>(end - p) < dataLength) {
+            failure = "A MIDI track ends in the middle of an event";
+            return false;
+        }
+        track.events.push_back({tick, 0, status, static_cast<uint8_t>(p[0] & 0x7F),
+                                static_cast<uint8_t>(dataLength == 2 ? p[1] & 0x7F : 0)});
+        p += dataLength;
+    }
+
+    track.endTick = tick;
+    file.tracks.push_back(std::move(track));
+    return true;
+}
+
+bool readMidi(const uint8_t* data, size_t size, MidiFile& file, std::string& failure) {
+    if (size < 14 || std::memcmp(data, "MThd", 4) != 0 || readBE32(data + 4) < 6) {
+        failure = "Not a MIDI file";
+        return false;
+    }
+    uint16_t format = readBE16(data + 8);
+    uint16_t division = readBE16(data + 12);
+    if (format > 1) {
+        failure = "Only format 0 and 1 MIDI files can be encoded";
+        return false;
+    }
+    if (division & 0x8000 || division == 0) {
+        failure = "SMPTE timed MIDI files can't be encoded, BMS counts ticks per quarter note";
+        return false;
+    }
+    file.ppqn = division;
+
+    size_t position = 8 + static_cast<size_t>(readBE32(data + 4));
+    while (position <= size && size - position >= 8) {
+        uint32_t length = readBE32(data + position + 4);
+        if (length > size - position - 8) {
+            failure = "A MIDI track ends early";
+            return false;
+        }
+        const uint8_t* chunk = data + position + 8;
+        if (std::memcmp(data + position, "MTrk", 4) == 0 && !readTrack(chunk, chunk + length, file, failure)) {
+            return false;
+        }
+        position += 8 + static_cast<size_t>(length);
+    }
+
+    return true;
+}
+
+/*Instructions*/
+
+/* An instruction packed into a word, its bytes from the low end up and the length in the top byte, so
+runs of instructions are compared and hashed as plain integers. */
+typedef uint64_t Instruction;
+
+const size_t CALL_SIZE = 4;
+const int VOICES = 7; // Note offs are 0x81-0x87, 0x88 is WAIT_16
+
+Instruction pack(std::initializer_list<uint8_t> bytes) {
+    Instruction packed = static_cast<Instruction>(bytes.size()) << 56;
+    int shift = 0;
+    for (uint8_t byte : bytes) {
+        packed |= static_cast<Instruction>(byte) << shift;
+        shift += 8;
+    }
+    return packed;
+}
+
+size_t lengthOf(Instruction instruction) {
+    return static_cast<size_t>(instruction >> 56);
+}
+
+uint8_t opcodeOf(Instruction instruction) {
+    return static_cast<uint8_t>(instruction);
+}
+
+void append(std::vector<uint8_t>& out, Instruction instruction) {
+    for (size_t i = 0; i < lengthOf(instruction); i++) {
+        out.push_back(static_cast<uint8_t>(instruction >> (8 * i)));
+    }
+}
+
+void appendWait(std::vector<Instruction>& run, uint32_t ticks) {
+    while (ticks > 0) {
+        if (ticks < 0x100) {
+            run.push_back(pack({WAIT_8, static_cast<uint8_t>(ticks)}));
+            return;
+        }
+        if (ticks < 0x10000) {
+            run.push_back(pack({WAIT_16, static_cast<uint8_t>(ticks >> 8), static_cast<uint8_t>(ticks)}));
+            return;
+        }
+        // Four VLQ bytes at most, longer rests are split
+        uint32_t part = std::min<uint32_t>(ticks, 0x0FFFFFFF);
+        if (part < 0x200000) {
+            run.push_back(pack({WAIT_VAR, static_cast<uint8_t>(0x80 | (part >> 14)), static_cast<uint8_t>(0x80 | ((part >> 7) & 0x7F)),
+                                static_cast<uint8_t>(part & 0x7F)}));
+        } else {
+            run.push_back(pack({WAIT_VAR, static_cast<uint8_t>(0x80 | (part >> 21)), static_cast<uint8_t>(0x80 | ((part >> 14) & 0x7F)),
+                                static_cast<uint8_t>(0x80 | ((part >> 7) & 0x7F)), static_cast<uint8_t>(part & 0x7F)}));
+        }
+        ticks -= part;
+    }
+}
+
+/*Lanes*/
+
+struct Lane {
+    std::vector<MidiEvent> events; // One channel's events, and the track's tempo changes in its first lane
+    uint32_t endTick = 0;
+};
+
+struct TimedInstruction {
+    uint32_t tick;
+    Instruction instruction;
+};
+
+struct EncodedTrack {
+    std::vector<TimedInstruction> code;
+    uint8_t busyVoices = 0;   // Bit per voice
+    uint32_t endTick = 0;     // Waited for at the end, the MIDI track's length for a lane's first track
+};
+
+// Controllers the decoder writes by itself, the bend range RPN and all notes off at the end of a track
+bool implied(const MidiEvent& event) {
+    if ((event.status & 0xF0) != 0xB0) {
+        return false;
+    }
+    return event.data1 == 0x06 || event.data1 == 0x26 || event.data1 == 0x64 || event.data1 == 0x65 || event.data1 == 0x7B;
+}
+
+/* Every channel of every MIDI track in the order they first show up, tracks stay in order so channels
+come back the same. Tempo changes go with the first lane of their track, those of tracks without
+channel events (a conductor track) go to `root`, which also lasts as long as the longest of them. */
+std::vector<Lane> splitLanes(const MidiFile& file, Lane& root) {
+    std::vector<Lane> lanes;
+    for (const MidiTrack& track : file.tracks) {
+        int laneOf[16];
+        std::fill(std::begin(laneOf), std::end(laneOf), -1);
+        size_t firstLane = SIZE_MAX;
+        std::vector<MidiEvent> pendingTempos; // Seen before the track's first lane
+
+        for (const MidiEvent& event : track.events) {
+            if (event.status == TEMPO_EVENT) {
+                if (firstLane == SIZE_MAX) {
+                    pendingTempos.push_back(event);
+                } else {
+                    lanes[firstLane].events.push_back(event);
+                }
+                continue;
+            }
+            if (implied(event)) {
+                continue;
+            }
+            int& lane = laneOf[event.status & 0x0F];
+            if (lane < 0) {
+                lane = static_cast<int>(lanes.size());
+                lanes.emplace_back();
+                lanes.back().endTick = track.endTick;
+                if (firstLane == SIZE_MAX) {
+                    firstLane = lane;
+                    lanes.back().events = std::move(pendingTempos);
+                    pendingTempos.clear();
+                }
+            }
+            lanes[lane].events.push_back(event);
+        }
+        if (firstLane == SIZE_MAX) {
+            root.events.insert(root.events.end(), pendingTempos.begin(), pendingTempos.end());
+            root.endTick = std::max(root.endTick, track.endTick);
+        }
+    }
+    std::stable_sort(root.events.begin(), root.events.end(), [](const MidiEvent& a, const MidiEvent& b) { return a.tick < b.tick; });
+    return lanes;
+}
+
+Instruction tempoInstruction(uint32_t tempo) {
+    // BMS tempo is whole beats per minute
+    uint32_t bpm = std::min<uint32_t>(0xFFFF, std::max<uint32_t>(1, (60000000 + tempo / 2) / std::max<uint32_t>(1, tempo)));
+    return pack({J2_TEMPO, static_cast<uint8_t>(bpm >> 8), static_cast<uint8_t>(bpm)});
+}
+
+// The decoder writes a program as bank (program / 128) + FIRST_BANK, then program % 128
+uint8_t programValue(uint8_t bank, uint8_t program) {
+    return (bank == FIRST_BANK + 1) ? static_cast<uint8_t>(128 + program) : program;
+}
+
+void pushInstruction(EncodedTrack& track, uint32_t tick, Instruction instruction) {
+    track.code.push_back({tick, instruction});
+}
+
+void pushProgram(EncodedTrack& track, uint32_t tick, uint8_t program) {
+    // Of two program changes in a row the decoder only applies the second, keep just that one
+    if (!track.code.empty() && track.code.back().tick == tick && opcodeOf(track.code.back().instruction) == J2_SET_PROG) {
+        track.code.pop_back();
+    }
+    pushInstruction(track, tick, pack({J2_SET_PROG, program}));
+}
+
+void encodeLane(const Lane& lane, std::vector<EncodedTrack>& tracks, EncodeResult& result) {
+    size_t first = tracks.size();
+    tracks.emplace_back();
+    tracks[first].endTick = lane.endTick;
+
+    // Selected before anything else so the track never plays on the previous track's channel,
+    // a program change on tick 0 is taken as that first program
+    uint8_t bank = 0;
+    uint8_t program = 0;
+    size_t initialProgram = lane.events.size();
+    for (size_t i = 0; i < lane.events.size() && lane.events[i].tick == 0; i++) {
+        const MidiEvent& event = lane.events[i];
+        if ((event.status & 0xF0) == 0xB0 && event.data1 == 0x00) {
+            bank = event.data2;
+        } else if ((event.status & 0xF0) == 0xC0) {
+            program = programValue(bank, event.data1);
+            initialProgram = i;
+            break;
+        }
+    }
+    pushProgram(tracks[first], 0, program);
+    bank = 0;
+
+    std::array<std::deque<uint32_t>, 128> playing; // Per note, (track - first) * 8 + voice of each copy sounding, oldest first
+
+    for (size_t i = 0; i < lane.events.size(); i++) {
+        const MidiEvent& event = lane.events[i];
+        uint8_t type = event.status & 0xF0;
+
+        if (event.status == TEMPO_EVENT) {
+            pushInstruction(tracks[first], event.tick, tempoInstruction(event.tempo));
+        } else if (type == 0x90 && event.data2 > 0) {
+            size_t track = first;
+            int voice = -1;
+            for (; track < tracks.size(); track++) {
+                for (int v = 0; v < VOICES; v++) {
+                    if (!(tracks[track].busyVoices & (1 << v))) {
+                        voice = v;
+                        break;
+                    }
+                }
+                if (voice >= 0) {
+                    break;
+                }
+            }
+            if (track == tracks.size()) {
+                // Every voice is taken, notes spill onto another track playing the same program
+                tracks.emplace_back();
+                pushProgram(tracks.back(), event.tick, program);
+                result.overflowTracks++;
+                voice = 0;
+            }
+            tracks[track].busyVoices |= 1 << voice;
+            pushInstruction(tracks[track], event.tick, pack({event.data1, static_cast<uint8_t>(voice + 1), event.data2}));
+            playing[event.data1].push_back(static_cast<uint32_t>((track - first) * 8 + voice));
+            result.noteCount++;
+        } else if (type == 0x80 || type == 0x90) {
+            std::deque<uint32_t>& copies = playing[event.data1];
+            if (copies.empty()) {
+                result.droppedEvents++;
+                continue;
+            }
+            EncodedTrack& track = tracks[first + copies.front() / 8];
+            int voice = copies.front() % 8;
+            copies.pop_front();
+            track.busyVoices &= ~(1 << voice);
+            pushInstruction(track, event.tick, pack({static_cast<uint8_t>(0x81 + voice)}));
+        } else if (type == 0xB0) {
+            switch (event.data1) {
+                case 0x00:
+                    bank = event.data2;
+                    break;
+                case 0x07:
+                    pushInstruction(tracks[first], event.tick, pack({J2_SET_PERF_8, MML_VOLUME, event.data2}));
+                    break;
+                case 0x0A:
+                    pushInstruction(tracks[first], event.tick, pack({J2_SET_PERF_8, MML_PAN, event.data2}));
+                    break;
+                case 0x5B:
+                    pushInstruction(tracks[first], event.tick, pack({J2_SET_PERF_8, MML_REVERB, event.data2}));
+                    break;
+                default:
+                    result.droppedEvents++;
+                    break;
+            }
+        } else if (type == 0xC0) {
+            if (i == initialProgram) {
+                continue;
+            }
+            program = programValue(bank, event.data1);
+            for (size_t track = first; track < tracks.size(); track++) {
+                pushProgram(tracks[track], event.tick, program);
+            }
+        } else if (type == 0xE0) {
+            // The decoder bends by value / 4 around the centre
+            int16_t pitch = static_cast<int16_t>(((event.data1 | (event.data2 << 7)) - 0x2000) * 4);
+            pushInstruction(tracks[first], event.tick, pack({J2_SET_PERF_16, MML_PITCH, static_cast<uint8_t>(pitch >> 8),
+                                                             static_cast<uint8_t>(pitch)}));
+        } else {
+            result.droppedEvents++;
+        }
+    }
+}
+
+// The track's instructions with the waits between them, ready for the subroutine search
+void flatten(const EncodedTrack& track, std::vector<Instruction>& run) {
+    uint32_t tick = 0;
+    for (const TimedInstruction& timed : track.code) {
+        appendWait(run, timed.tick - tick);
+        tick = timed.tick;
+        run.push_back(timed.instruction);
+    }
+    if (track.endTick > tick) {
+        appendWait(run, track.endTick - tick);
+    }
+}
+
+/*Subroutines*/
+
+struct Subroutine {
+    uint32_t first;   // Instructions [first, first + length) of the run
+    uint32_t length;
+};
+
+uint64_t mix(Instruction instruction) {
+    uint64_t x = instruction * 0x9E3779B97F4A7C15ull;
+    return x ^ (x >> 29);
+}
+
+/* Greedy search over the runs of all tracks in order. Windows of `window` instructions are hashed as
+they're passed, the first place each hash was seen is kept. A window seen before in instructions that
+aren't part of a subroutine yet is extended as far as both copies match without overlapping, and the
+copies become a subroutine when that's smaller than leaving both inline. A window seen at the start of a
+subroutine is called if the whole subroutine matches. */
+class SubroutineFinder {
+public:
+    std::vector<int32_t> callAt;   // Per instruction, the subroutine called in its place or -1
+    std::vector<Subroutine> subroutines;
+    size_t calls = 0;
+
+    SubroutineFinder(const std::vector<Instruction>& run, uint32_t minimumRun) :
+        callAt(run.size(), -1),
+        run(run),
+        window(std::max<uint32_t>(2, minimumRun)),
+        subroutineAt(run.size(), -1),
+        used(run.size(), false),
+        byteOffsets(run.size() + 1, 0) {
+        for (size_t i = 0; i < run.size(); i++) {
+            byteOffsets[i + 1] = byteOffsets[i] + lengthOf(run[i]);
+        }
+        power = 1;
+        for (uint32_t i = 1; i < window; i++) {
+            power *= BASE;
+        }
+        firstSeen.reserve(run.size());
+    }
+
+    void search(uint32_t begin, uint32_t end) {
+        uint32_t i = begin;
+        bool hashed = false;
+        uint64_t hash = 0;
+
+        while (end - i >= window) {
+            if (!hashed) {
+                hash = 0;
+                for (uint32_t k = 0; k < window; k++) {
+                    hash = hash * BASE + mix(run[i + k]);
+                }
+                hashed = true;
+            }
+
+            auto seen = firstSeen.find(hash);
+            if (seen == firstSeen.end()) {
+                firstSeen.emplace(hash, i);
+            } else {
+                uint32_t length = match(seen->second, i, end);
+                if (length > 0) {
+                    i += length;
+                    hashed = false;
+                    continue;
+                }
+                // Swallowed by a call site or a subroutine (they're never shorter than a window, so they
+                // cover one of its ends), this copy is the one to find from now on
+                uint32_t earlier = seen->second;
+                if (subroutineAt[earlier] < 0 && (used[earlier] || used[earlier + window - 1])) {
+                    seen->second = i;
+                }
+            }
+
+            if (end - i > window) {
+                hash = (hash - mix(run[i]) * power) * BASE + mix(run[i + window]);
+            }
+            i++;
+        }
+    }
+
+private:
+    static const uint64_t BASE = 0x100000001B3ull;
+
+    const std::vector<Instruction>& run;
+    uint32_t window;
+    std::vector<int32_t> subroutineAt;   // Per instruction, the subroutine starting there or -1
+    std::vector<bool> used;              // Already in a subroutine or replaced by a call
+    std::vector<size_t> byteOffsets;
+    std::unordered_map<uint64_t, uint32_t> firstSeen;
+    uint64_t power;
+
+    size_t bytes(uint32_t first, uint32_t length) const {
+        return byteOffsets[first + length] - byteOffsets[first];
+    }
+
+    void replace(uint32_t at, uint32_t length, int32_t subroutine) {
+        callAt[at] = subroutine;
+        std::fill(used.begin() + at, used.begin() + at + length, true);
+        calls++;
+    }
+
+    // Instructions covered by a call placed at `at`, 0 when there's nothing worth calling
+    uint32_t match(uint32_t earlier, uint32_t at, uint32_t end) {
+        int32_t existing = subroutineAt[earlier];
+        if (existing >= 0) {
+            const Subroutine& subroutine = subroutines[existing];
+            if (end - at < subroutine.length || bytes(subroutine.first, subroutine.length) <= CALL_SIZE ||
+                !std::equal(run.begin() + subroutine.first, run.begin() + subroutine.first + subroutine.length, run.begin() + at)) {
+                return 0;
+            }
+            replace(at, subroutine.length, existing);
+            return subroutine.length;
+        }
+
+        uint32_t length = 0;
+        while (at + length < end && earlier + length < at && !used[earlier + length] && run[earlier + length] == run[at + length]) {
+            length++;
+        }
+        // Two calls and a RET have to cost less than the second copy
+        if (length < window || bytes(earlier, length) <= 2 * CALL_SIZE + 1) {
+            return 0;
+        }
+
+        int32_t subroutine = static_cast<int32_t>(subroutines.size());
+        subroutines.push_back({earlier, length});
+        subroutineAt[earlier] = subroutine;
+        replace(earlier, length, subroutine);
+        replace(at, length, subroutine);
+        return length;
+    }
+};
+
+/*Layout*/
+
+void put24(std::vector<uint8_t>& out, size_t at, uint32_t value) {
+    out[at] = static_cast<uint8_t>(value >> 16);
+    out[at + 1] = static_cast<uint8_t>(value >> 8);
+    out[at + 2] = static_cast<uint8_t>(value);
+}
+
+} // namespace
+
+/*Encoding*/
+
+EncodeResult encodeBMS(const uint8_t* midi, size_t size, const EncodeOptions& options) {
+    EncodeResult result;
+    MidiFile file;
+    if (!readMidi(midi, size, file, result.failure)) {
+        return result;
+    }
+    result.droppedEvents = file.droppedEvents;
+
+    std::vector<EncodedTrack> encoded;
+    Lane root;
+    for (const Lane& lane : splitLanes(file, root)) {
+        encodeLane(lane, encoded, result);
+    }
+    // OPEN_TRACK numbers are a byte and the last one marks the end of the root track
+    if (encoded.size() > 255) {
+        result.failure = "The sequence needs more than 255 tracks";
+        return result;
+    }
+    result.trackCount = encoded.size();
+
+    std::vector<Instruction> run;
+    std::vector<std::pair<uint32_t, uint32_t>> trackRuns; // [first, end) of every track in the run
+    for (const EncodedTrack& track : encoded) {
+        uint32_t first = static_cast<uint32_t>(run.size());
+        flatten(track, run);
+        trackRuns.push_back({first, static_cast<uint32_t>(run.size())});
+    }
+    encoded.clear();
+
+    SubroutineFinder finder(run, options.minimumRun);
+    if (options.subroutines) {
+        for (const auto& range : trackRuns) {
+            finder.search(range.first, range.second);
+        }
+    }
+    result.subroutineCount = finder.subroutines.size();
+    result.callCount = finder.calls;
+
+    // Root track: an OPEN_TRACK per track, then one more whose offset is where the root ends
+    std::vector<uint8_t>& out = result.bms;
+    out.resize(5 * (trackRuns.size() + 1));
+    for (size_t i = 0; i <= trackRuns.size(); i++) {
+        out[5 * i] = OPEN_TRACK;
+        out[5 * i + 1] = static_cast<uint8_t>(i);
+    }
+    append(out, pack({J2_SET_ARTIC, 0x62, static_cast<uint8_t>(file.ppqn >> 8), static_cast<uint8_t>(file.ppqn)}));
+    std::vector<Instruction> rootRun;
+    uint32_t tick = 0;
+    for (const MidiEvent& change : root.events) {
+        appendWait(rootRun, change.tick - tick);
+        tick = change.tick;
+        rootRun.push_back(tempoInstruction(change.tempo));
+    }
+    appendWait(rootRun, root.endTick - std::min(tick, root.endTick));
+    for (Instruction instruction : rootRun) {
+        append(out, instruction);
+    }
+    out.push_back(FIN);
+    put24(out, 5 * trackRuns.size() + 2, static_cast<uint32_t>(out.size()));
+
+    size_t inlineBytes = out.size();
+    std::vector<std::pair<size_t, int32_t>> callFixups;
+    for (size_t track = 0; track < trackRuns.size(); track++) {
+        put24(out, 5 * track + 2, static_cast<uint32_t>(out.size()));
+        for (uint32_t i = trackRuns[track].first; i < trackRuns[track].second;) {
+            inlineBytes += lengthOf(run[i]);
+            int32_t subroutine = finder.callAt[i];
+            if (subroutine < 0) {
+                append(out, run[i++]);
+                continue;
+            }
+            out.push_back(CALL);
+            callFixups.push_back({out.size(), subroutine});
+            out.resize(out.size() + 3);
+            i++;
+            for (uint32_t k = 1; k < finder.subroutines[subroutine].length; k++, i++) {
+                inlineBytes += lengthOf(run[i]);
+            }
+        }
+        out.push_back(FIN);
+        inlineBytes++;
+    }
+
+    std::vector<uint32_t> subroutineOffsets;
+    for (const Subroutine& subroutine : finder.subroutines) {
+        subroutineOffsets.push_back(static_cast<uint32_t>(out.size()));
+        for (uint32_t i = subroutine.first; i < subroutine.first + subroutine.length; i++) {
+            append(out, run[i]);
+        }
+        out.push_back(RET);
+    }
+
+    // Offsets are 24 bits
+    if (out.size() > 0xFFFFFF) {
+        result.bms.clear();
+        result.failure = "The sequence doesn't fit in the 16MB BMS offsets can reach";
+        return result;
+    }
+    for (const auto& fixup : callFixups) {
+        put24(out, fixup.first, subroutineOffsets[fixup.second]);
+    }
+
+    // Zero padded to 32 bytes like the game's files
+    out.resize((out.size() + 31) / 32 * 32, 0x00);
+    result.inlineBytes = (inlineBytes + 31) / 32 * 32;
+    result.ok = true;
+    return result;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* MIDI to BMS encoder, the way back into the game. Writes Twilight Princess sequences using only
+what the decoder reads back: OPEN_TRACK, notes on voices, WAIT_8/WAIT_16/WAIT_VAR, J2_SET_PROG,
+J2_SET_PERF_* for volume, pan, reverb and pitch, J2_TEMPO and CALL/RET. Runs of instructions that
+repeat, within a track or across tracks, are moved into subroutines and CALLed. */
+
+struct EncodeOptions {
+    bool subroutines = true;     // Factor repeated runs out into CALLed subroutines
+    uint32_t minimumRun = 4;     // Fewest instructions a subroutine is made of
+};
+
+struct EncodeResult {
+    bool ok = false;
+    std::string failure;
+    std::vector<uint8_t> bms;    // The .bms file
+    size_t trackCount = 0;       // Tracks opened by the root track
+    size_t overflowTracks = 0;   // Of those, extra tracks for channels playing more than 7 notes at once
+    size_t noteCount = 0;
+    size_t droppedEvents = 0;    // Channel events BMS has no instruction for (aftertouch, other controllers, sysex)
+    size_t inlineBytes = 0;      // What the file would take without subroutines
+    size_t subroutineCount = 0;
+    size_t callCount = 0;
+};
+
+// Encodes the bytes of a format 0 or 1 MIDI file. Channels come back from the decoder in the order
+// their programs are first selected, so channels sharing a program end up sharing a channel.
+EncodeResult encodeBMS(const uint8_t* midi, size_t size, const EncodeOptions& options = EncodeOptions());
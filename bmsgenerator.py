@@ -0,0 +1,162 @@
+import argparse
+import random
+import struct
+
+# Writes synthetic Twilight Princess style BMS sequences for benchmarking bmsanalyzer.
+# The same arguments (and seed) always produce the same file, so results can be compared between builds.
+
+OPEN_TRACK = 0xC1
+CALL = 0xC3
+RET = 0xC5
+JUMP = 0xC7
+FIN = 0xFF
+WAIT_8 = 0x80
+WAIT_16 = 0x88
+J2_SET_PERF_8 = 0xB8
+J2_SET_PERF_16 = 0xB9
+J2_SET_ARTIC = 0xD8
+J2_TEMPO = 0xE0
+J2_SET_BANK = 0xE2
+J2_SET_PROG = 0xE3
+PERF_U8_DUR_U8 = 0x96
+PERF_S16_DUR_U16 = 0x9F
+
+MML_VOLUME = 0
+MML_PITCH = 1
+MML_REVERB = 2
+MML_PAN = 3
+
+PPQN = 120
+MAX_PROGRAMS = 16
+
+
+def offset24(offset):
+    # BMS offsets are 24 bits, a file past 16 MiB can't be addressed
+    if offset > 0xFFFFFF:
+        raise ValueError("offset 0x%x doesn't fit in 24 bits, the sequence would be over 16 MiB" % offset)
+    return struct.pack(">I", offset)[1:]
+
+
+def wait(ticks):
+    if ticks < 0x100:
+        return bytes([WAIT_8, ticks])
+    return bytes([WAIT_16]) + struct.pack(">H", ticks)
+
+
+def note(rng, voice, length):
+    # Note on (note, voice, velocity), hold it, then the voice's note off
+    return bytes([rng.randint(36, 96), voice, rng.randint(40, 127)]) + wait(length) + bytes([0x80 + voice])
+
+
+def ramp(rng):
+    # SET_PERF with a fade duration, the converter applies the target value straight away
+    if rng.random() < 0.5:
+        return bytes([PERF_U8_DUR_U8, rng.choice([MML_VOLUME, MML_REVERB, MML_PAN]), rng.randint(0, 127), rng.randint(1, 60)])
+    return bytes([PERF_S16_DUR_U16, MML_PITCH]) + struct.pack(">hH", rng.randint(-8000, 8000), rng.randint(1, 480))
+
+
+def pattern(rng, step):
+    # Short drum/ostinato style subroutine
+    body = bytearray()
+    for _ in range(rng.randint(4, 16)):
+        body += note(rng, 1, step)
+    body += bytes([RET])
+    return body
+
+
+def track(rng, args, step, pattern_offsets, programs, start):
+    body = bytearray([J2_SET_BANK, 0x00, J2_SET_PROG, rng.choice(programs)])
+    body += bytes([J2_SET_PERF_8, MML_VOLUME, 100, J2_SET_PERF_8, MML_PAN, 64, J2_SET_PERF_16, MML_PITCH, 0x00, 0x00])
+    loop_start = start + len(body)
+    calls = []
+
+    for _ in range(args.notes):
+        roll = rng.random()
+        if pattern_offsets and roll < args.call_rate:
+            calls.append(len(body) + 1)
+            body += bytes([CALL, 0, 0, 0])
+        elif roll < args.call_rate + args.ramp_rate:
+            body += ramp(rng)
+        else:
+            body += note(rng, rng.randint(1, 7), step)
+
+    if args.loop:
+        body += bytes([JUMP]) + offset24(loop_start)
+    body += bytes([FIN])
+    return body, calls
+
+
+def generate(args):
+    rng = random.Random(args.seed)
+    step = max(1, PPQN // args.density)
+
+    # Root track: one OPEN_TRACK per track plus the "last track" entry marking where the root ends
+    header_size = 5 * (args.tracks + 1)
+    root_body = bytes([J2_SET_ARTIC, 0x62]) + struct.pack(">H", PPQN) + bytes([J2_TEMPO]) + struct.pack(">H", args.tempo) + bytes([FIN])
+    root_end = header_size + len(root_body)
+
+    patterns = [pattern(rng, step) for _ in range(args.patterns)]
+    # Tracks with the same program share a MIDI channel, more than 16 programs can't be converted
+    programs = random.Random(args.seed).sample(range(128), MAX_PROGRAMS)
+
+    # Tracks follow the root back to back (a track ends where the next one starts), the subroutines go last
+    tracks = []
+    offset = root_end
+    for _ in range(args.tracks):
+        body, calls = track(rng, args, step, patterns, programs, offset)
+        tracks.append((offset, body, calls))
+        offset += len(body)
+
+    pattern_offsets = []
+    for body in patterns:
+        pattern_offsets.append(offset)
+        offset += len(body)
+
+    out = bytearray()
+    for number, (start, _, _) in enumerate(tracks):
+        out += bytes([OPEN_TRACK, number]) + offset24(start)
+    out += bytes([OPEN_TRACK, args.tracks]) + offset24(root_end)
+    out += root_body
+
+    for _, body, calls in tracks:
+        for call in calls:
+            body[call:call + 3] = offset24(rng.choice(pattern_offsets))
+        out += body
+    for body in patterns:
+        out += body
+
+    # Real files are zero padded to 32 bytes
+    out += bytes(-len(out) % 32)
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate a synthetic BMS sequence")
+    parser.add_argument("output", help="path of the .bms file to write")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--tracks", type=int, default=8, help="number of tracks (max 255), they share 16 programs")
+    parser.add_argument("--notes", type=int, default=2000, help="steps per track, each a note, a CALL or a ramp")
+    parser.add_argument("--density", type=int, default=4, help="notes per quarter note")
+    parser.add_argument("--patterns", type=int, default=4, help="shared pattern subroutines, 0 for none")
+    parser.add_argument("--call-rate", type=float, default=0.2, help="chance a step calls a pattern")
+    parser.add_argument("--ramp-rate", type=float, default=0.1, help="chance a step is a SET_PERF ramp")
+    parser.add_argument("--tempo", type=int, default=120, help="BPM")
+    parser.add_argument("--no-loop", dest="loop", action="store_false", help="end tracks with FIN instead of a JUMP back")
+    args = parser.parse_args()
+    if not 1 <= args.tracks <= 255:
+        parser.error("--tracks must be between 1 and 255")
+    if args.density < 1:
+        parser.error("--density must be at least 1")
+    if not 1 <= args.tempo <= 0xFFFF:
+        parser.error("--tempo must be between 1 and 65535")
+
+    try:
+        data = generate(args)
+    except ValueError as e:
+        parser.error(str(e))
+    with open(args.output, "wb") as f:
+        f.write(data)
+
+
+if __name__ == "__main__":
+    main()
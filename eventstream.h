@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/*Event Stream*/
+
+// Decoded events, what the converter writes to MIDI and the renderer (sf2renderer.h) plays
+
+enum EventType : uint8_t {
+    EV_NOTE_ON,         // data1 note, data2 velocity
+    EV_NOTE_OFF,        // data1 note
+    EV_PROGRAM,         // data1 program (bank is program / 128)
+    EV_VOLUME,          // data1 value
+    EV_PAN,             // data1 value
+    EV_REVERB,          // data1 value
+    EV_PITCH_BEND,      // data1 14-bit MIDI pitch bend
+    EV_TEMPO,           // data1 microseconds per quarter note
+    EV_ALL_NOTES_OFF,
+    EV_MARKER           // data1 LoopMarker
+};
+
+enum LoopMarker : uint8_t {
+    LOOP_START,
+    LOOP_END
+};
+
+// Decoded events of one track as a structure of arrays, index i across the columns is one event
+struct EventStream {
+    std::vector<uint32_t> ticks;    // Absolute tick
+    std::vector<uint8_t> types;     // EventType
+    std::vector<uint8_t> channels;  // MIDI channel once resolved, a program slot while decoding
+    std::vector<uint32_t> data1;
+    std::vector<uint8_t> data2;
+
+    void push(uint32_t tick, EventType type, uint8_t channel, uint32_t value1, uint8_t value2 = 0) {
+        ticks.push_back(tick);
+        types.push_back(type);
+        channels.push_back(channel);
+        data1.push_back(value1);
+        data2.push_back(value2);
+    }
+
+    void reserve(size_t count) {
+        ticks.reserve(count);
+        types.reserve(count);
+        channels.reserve(count);
+        data1.reserve(count);
+        data2.reserve(count);
+    }
+
+    size_t size() const {
+        return types.size();
+    }
+
+    // Appends a copy of events [first, last) with their ticks moved by tickOffset, used to replay loop bodies
+    void replay(size_t first, size_t last, uint32_t tickOffset) {
+        size_t base = size();
+        size_t count = last - first;
+
+        ticks.resize(base + count);
+        for (size_t i = 0; i < count; i++) {
+            ticks[base + i] = ticks[first + i] + tickOffset;
+        }
+        copyRange(types, first, last, base);
+        copyRange(channels, first, last, base);
+        copyRange(data1, first, last, base);
+        copyRange(data2, first, last, base);
+    }
+
+    // Builds a new stream with `inserted` placed before the events at their index, indexes must be ascending
+    void insertEvents(const std::vector<std::pair<size_t, EventStream>>& inserted) {
+        EventStream merged;
+        merged.reserve(size() + inserted.size());
+        size_t next = 0;
+        for (size_t i = 0; i <= size(); i++) {
+            for (; next < inserted.size() && inserted[next].first == i; next++) {
+                merged.append(inserted[next].second);
+            }
+            if (i < size()) {
+                merged.push(ticks[i], static_cast<EventType>(types[i]), channels[i], data1[i], data2[i]);
+            }
+        }
+        *this = std::move(merged);
+    }
+
+    void append(const EventStream& other) {
+        ticks.insert(ticks.end(), other.ticks.begin(), other.ticks.end());
+        types.insert(types.end(), other.types.begin(), other.types.end());
+        channels.insert(channels.end(), other.channels.begin(), other.channels.end());
+        data1.insert(data1.end(), other.data1.begin(), other.data1.end());
+        data2.insert(data2.end(), other.data2.begin(), other.data2.end());
+    }
+
+private:
+    template <typename T>
+    static void copyRange(std::vector<T>& column, size_t first, size_t last, size_t base) {
+        column.resize(base + (last - first));
+        std::copy(column.begin() + first, column.begin() + last, column.begin() + base);
+    }
+};
+
+// MIDI bank of program 0 (EV_PROGRAM / 128 counts up from it), where the TP soundfont's banks start
+const uint8_t FIRST_BANK = 0x16;
+
+// Semitones a full pitch bend covers, sent as RPN 0 before a track's first bend (writePitchSetup)
+const uint8_t PITCH_BEND_RANGE = 48;
@@ -7,16 +7,14 @@ bms_to_midi_converter_executable = "bmsanalyzer.exe"
 # Path to the folder containing the .bms files
 bms_folder = os.getcwd()
 
-def convert_bms_to_midi(bms_file):
-    # Build the command to run the BMS to MIDI converter
-    command = [bms_to_midi_converter_executable, bms_file]
+def convert_bms_folder(folder):
+    # Convert every .bms in the folder inside a single converter process, across all cores
+    command = [bms_to_midi_converter_executable, "--batch", folder]
 
     try:
-        # Run the BMS to MIDI converter for the current BMS file
         subprocess.run(command, check=True)
-        print(f"Conversion successful for {bms_file}")
     except subprocess.CalledProcessError as e:
-        print(f"Error converting {bms_file}: {e}")
+        print(f"Some files in {folder} failed to convert: {e}")
 
 def main():
     # Get a list of all files in the folder
@@ -26,9 +24,7 @@ def main():
         print("No .bms files found in the folder.")
         return
 
-    for bms_file in bms_files:
-        bms_file_path = os.path.join(bms_folder, bms_file)
-        convert_bms_to_midi(bms_file_path)
+    convert_bms_folder(bms_folder)
 
 if __name__ == "__main__":
     main()
@@ -0,0 +1,103 @@
+#pragma once
+
+/* Opcodes of the BMS sequence format, shared by the decoder (bmsconverter.cpp) and the encoder (bmsencoder.cpp) */
+
+// Thanks XAYRGA for most track keys
+enum MML {
+    OPEN_TRACK          = 0xC1,
+    NOTE_TRACK          = 0xF9,
+    WAIT_8              = 0x80,
+    WAIT_16             = 0x88,
+    WAIT_VAR            = 0xF0,
+    CALL                = 0xC3,
+    RET                 = 0xC5,
+    JUMP                = 0xC7,
+    FIN                 = 0xFF,
+
+    J2_SET_PERF_8       = 0xB8,
+    J2_SET_PERF_16      = 0xB9,
+    J2_SET_ARTIC        = 0xD8,
+    J2_TEMPO            = 0xE0,
+    J2_SET_BANK         = 0xE2,
+    J2_SET_PROG         = 0xE3,
+
+    /* Skipped over by the decoder, operand sizes are known but the effect isn't converted.
+    Thought to be used for ingame events (if boss stunned -> heroic_part),
+    no loss of quality has been seen in midi files due to their absence. */
+
+    OPEN_TRACK_BROS     = 0xC2, // 1
+    CALL_COND           = 0xC4, // 4
+    RET_COND            = 0xC6, // 1
+    JUMP_COND           = 0xC8, // 4
+
+    NAME_BUS            = 0xD0, // 2
+    D1                  = 0xD1, // 2
+    D5                  = 0xD5, // 0
+    D9                  = 0xD9, // 3
+    DA                  = 0xDA, // Runs until the next flow opcode
+    DC                  = 0xDC, // 11
+
+    SYNC_CPU            = 0xE7, // 2
+    WAIT_24             = 0xEA,
+    EB                  = 0xEB, // 0
+    FA                  = 0xFA, // 5
+    NAME_CHECK          = 0xFD, // Zero terminated, zero padded
+
+    // Older (JAudio 1) performance events, same parameters as J2_SET_PERF plus a fade duration
+    PERF_U8_NODUR       = 0x94,
+    PERF_U8_DUR_U8      = 0x96,
+    PERF_U8_DUR_U16     = 0x97,
+    PERF_S8_NODUR       = 0x98,
+    PERF_S8_DUR_U8      = 0x9A,
+    PERF_S8_DUR_U16     = 0x9B,
+    PERF_S16_NODUR      = 0x9C,
+    PERF_S16_DUR_U8     = 0x9E,
+    PERF_S16_DUR_U16    = 0x9F,
+
+    /* Unused / Unimplemented
+    Many of these are subject to change from J2's audio system. 
+    Some are named their variables as they've been spotted, but unidentified*/
+    
+    // PARAM_SET           = 0xA0,
+    // ADDR                = 0xA1,
+    // MULR                = 0xA2,
+    // CMPR                = 0xA3,
+    // PARAM_SET_8         = 0xA4, 
+    // ADD8                = 0xA5,
+    // MUL8                = 0xA6,
+    // CMP8                = 0xA7,
+    // BITWISE             = 0xA9,
+    // LOADTBL             = 0xAA,
+    // SUB                 = 0xAB,
+    // PARAM_SET_16        = 0xAC,
+    // ADD16               = 0xAD,
+    // MUL16               = 0xAE,
+    // CMP16               = 0xAF,
+    // LOAD_TABLE          = 0xAA,
+    // SUBTRACT            = 0xAB,
+
+    // OSCILLATORFULL      = 0xF2,  
+    // PRINTF              = 0xFB,
+    // TEMPO               = 0xFE,
+
+    // INTERRUPT_TIMER     = 0xE4,
+    // PANSWSET            = 0xEF,
+
+    // ADSR                = 0xD8,
+    // BUS_CONNECT         = 0xDD,
+    // INTERRUPT           = 0xDF,
+
+    // LOOP_COUNT          = 0xC9,
+    // PORTREAD            = 0xCB,
+    // PORTWRITE           = 0xCC,
+    // SPECIALWAIT         = 0xCF,
+
+};
+
+enum EffectType {
+    MML_VOLUME = 0,
+    MML_PITCH = 1,
+    MML_REVERB = 2,
+    MML_PAN = 3,
+    MML_EFFECT_UNKNOWN = 4
+};
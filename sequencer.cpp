@@ -0,0 +1,268 @@
+#include "sequencer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <queue>
+#include <thread>
+
+/* Real-time sequencer
+
+Playback runs in two steps on one thread. The scheduler walks the tracks in tick order and turns events
+into timestamped messages, but only up to `lookahead` seconds past the clock, so a tempo change reached
+on the way applies to everything after it without a tempo map built up front. The dispatcher sleeps
+until just before the next message is due, spins the rest of the way and writes it.
+
+ */
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+/*Messages*/
+
+struct Message {
+    double due;            // Seconds since playback start
+    double queuedAt;
+    uint8_t bytes[3];
+    uint8_t length;
+};
+
+// Raw MIDI for one event, the same messages the MIDI writer puts in the file minus the meta events
+class MessageEncoder {
+public:
+    explicit MessageEncoder(size_t trackCount) : pitchSetup(trackCount, false) {}
+
+    void encode(const EventStream& events, size_t index, size_t track, double due, double now, std::deque<Message>& out) {
+        uint8_t channel = events.channels[index] & 0x0F;
+        uint32_t value = events.data1[index];
+
+        switch (events.types[index]) {
+            case EV_NOTE_ON:
+                push(out, due, now, 0x90 | channel, value, events.data2[index]);
+                break;
+            case EV_NOTE_OFF:
+                push(out, due, now, 0x80 | channel, value, 0x40);
+                break;
+            case EV_PROGRAM: {
+                uint8_t bank = value / 128;
+                push(out, due, now, 0xB0 | channel, 0x00, bank + FIRST_BANK);
+                push(out, due, now, 0xC0 | channel, value - 128 * bank);
+                break;
+            }
+            case EV_VOLUME:
+                push(out, due, now, 0xB0 | channel, 0x07, value);
+                break;
+            case EV_PAN:
+                push(out, due, now, 0xB0 | channel, 0x0A, value);
+                break;
+            case EV_REVERB:
+                push(out, due, now, 0xB0 | channel, 0x5B, value);
+                break;
+            case EV_PITCH_BEND:
+                if (!pitchSetup[track]) {
+                    // Bend range RPN, like the writer sends ahead of each track's first bend
+                    push(out, due, now, 0xB0 | channel, 0x64, 0x00);
+                    push(out, due, now, 0xB0 | channel, 0x65, 0x00);
+                    push(out, due, now, 0xB0 | channel, 0x06, PITCH_BEND_RANGE);
+                    push(out, due, now, 0xB0 | channel, 0x26, 0x00);
+                    push(out, due, now, 0xB0 | channel, 0x64, 0x7F);
+                    push(out, due, now, 0xB0 | channel, 0x65, 0x7F);
+                    pitchSetup[track] = true;
+                }
+                push(out, due, now, 0xE0 | channel, value & 0x7F, (value >> 7) & 0x7F);
+                break;
+            case EV_ALL_NOTES_OFF:
+                push(out, due, now, 0xB0 | channel, 0x7B, 0x00);
+                break;
+            case EV_TEMPO:
+            case EV_MARKER:
+                // Tempo is applied by the scheduler, markers have nothing to play
+                break;
+        }
+    }
+
+private:
+    std::vector<bool> pitchSetup;
+
+    static void push(std::deque<Message>& out, double due, double now, uint8_t status, uint32_t data1) {
+        out.push_back({due, now, {status, static_cast<uint8_t>(data1 & 0x7F), 0}, 2});
+    }
+
+    static void push(std::deque<Message>& out, double due, double now, uint8_t status, uint32_t data1, uint32_t data2) {
+        out.push_back({due, now, {status, static_cast<uint8_t>(data1 & 0x7F), static_cast<uint8_t>(data2 & 0x7F)}, 3});
+    }
+};
+
+/*Scheduler*/
+
+// Merges the tracks by tick, ties go to the lower track like in a format 1 MIDI file
+class Scheduler {
+public:
+    Scheduler(const std::vector<EventStream>& tracks, uint16_t ppqn) :
+        tracks(tracks),
+        encoder(tracks.size()),
+        ticksPerQuarter(ppqn > 0 ? ppqn : 1) {
+        secondsPerTick = 500000.0 / 1e6 / ticksPerQuarter; // 120 BPM until the first tempo
+
+        for (size_t track = 0; track < tracks.size(); track++) {
+            if (tracks[track].size() > 0) {
+                cursors.push({tracks[track].ticks[0], track, 0});
+            }
+        }
+    }
+
+    bool finished() const {
+        return cursors.empty();
+    }
+
+    // Due time of the next event, only valid while not finished
+    double nextDue() const {
+        return time + (cursors.top().tick - tick) * secondsPerTick;
+    }
+
+    // Queues every event due before `until`
+    void scheduleUntil(double until, double now, std::deque<Message>& out) {
+        while (!cursors.empty() && nextDue() < until) {
+            time = nextDue();
+            Cursor cursor = cursors.top();
+            cursors.pop();
+            tick = cursor.tick;
+
+            const EventStream& events = tracks[cursor.track];
+            if (events.types[cursor.index] == EV_TEMPO && events.data1[cursor.index] > 0) {
+                secondsPerTick = events.data1[cursor.index] / 1e6 / ticksPerQuarter;
+            }
+            encoder.encode(events, cursor.index, cursor.track, time, now, out);
+
+            if (cursor.index + 1 < events.size()) {
+                cursors.push({events.ticks[cursor.index + 1], cursor.track, cursor.index + 1});
+            }
+        }
+    }
+
+private:
+    struct Cursor {
+        uint32_t tick;
+        size_t track;
+        size_t index;
+
+        bool operator>(const Cursor& other) const {
+            return tick != other.tick ? tick > other.tick : track > other.track;
+        }
+    };
+
+    const std::vector<EventStream>& tracks;
+    MessageEncoder encoder;
+    std::priority_queue<Cursor, std::vector<Cursor>, std::greater<Cursor>> cursors;
+    uint32_t ticksPerQuarter;
+    double secondsPerTick;
+    uint32_t tick = 0;     // Tick and time of the last scheduled event, tempo changes take effect from here
+    double time = 0;
+};
+
+/*Statistics*/
+
+PlaybackStats summarize(std::vector<double>& lateness, double leadTotal, double writeTotal, double duration) {
+    PlaybackStats stats;
+    stats.messages = lateness.size();
+    stats.duration = duration;
+    if (lateness.empty()) {
+        return stats;
+    }
+
+    double total = 0;
+    for (double value : lateness) {
+        total += value;
+        if (value > 0.001) {
+            stats.lateMessages++;
+        }
+    }
+    stats.meanLateness = total / lateness.size();
+
+    double variance = 0;
+    for (double value : lateness) {
+        variance += (value - stats.meanLateness) * (value - stats.meanLateness);
+    }
+    stats.jitter = std::sqrt(variance / lateness.size());
+
+    std::sort(lateness.begin(), lateness.end());
+    stats.medianLateness = lateness[lateness.size() / 2];
+    stats.p99Lateness = lateness[std::min(lateness.size() - 1, lateness.size() * 99 / 100)];
+    stats.maxLateness = lateness.back();
+    stats.meanLead = leadTotal / lateness.size();
+    stats.meanWrite = writeTotal / lateness.size();
+    return stats;
+}
+
+} // namespace
+
+/*Playback*/
+
+PlaybackResult playSequence(const std::vector<EventStream>& tracks, uint16_t ppqn, std::ostream& sink,
+                            const PlaybackOptions& options) {
+    PlaybackResult result;
+    Scheduler scheduler(tracks, ppqn);
+    std::deque<Message> queue;
+
+    std::vector<double> lateness;
+    double leadTotal = 0;
+    double writeTotal = 0;
+    double lookahead = std::max(options.lookahead, 0.0);
+    std::chrono::duration<double> spin(std::max(options.spin, 0.0));
+
+    // Starts one lookahead in, so the first events are queued as early as any other
+    Clock::time_point start = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(lookahead));
+    auto elapsed = [&start] { return std::chrono::duration<double>(Clock::now() - start).count(); };
+    auto pointAt = [&start](double seconds) {
+        return start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+    };
+
+    double firstSent = -1;
+    double lastSent = 0;
+
+    while (!scheduler.finished() || !queue.empty()) {
+        double now = elapsed();
+        scheduler.scheduleUntil(now + lookahead, now, queue);
+
+        if (queue.empty()) {
+            // Nothing in the window (long rests, or only tempo and markers), sleep until the next event enters it
+            if (!scheduler.finished()) {
+                std::this_thread::sleep_until(pointAt(scheduler.nextDue() - lookahead));
+            }
+            continue;
+        }
+
+        const Message& message = queue.front();
+        Clock::time_point due = pointAt(message.due);
+        if (Clock::now() + spin < due) {
+            std::this_thread::sleep_until(due - std::chrono::duration_cast<Clock::duration>(spin));
+        }
+        while (Clock::now() < due) {
+            // Spin the last stretch, sleeps overshoot by more than a millisecond on most systems
+        }
+
+        double sent = elapsed();
+        sink.write(reinterpret_cast<const char*>(message.bytes), message.length);
+        sink.flush();
+        writeTotal += elapsed() - sent;
+        if (!sink) {
+            result.failure = "Failed to write to the MIDI output";
+            result.stats = summarize(lateness, leadTotal, writeTotal, lastSent - firstSent);
+            return result;
+        }
+
+        lateness.push_back(sent - message.due);
+        leadTotal += message.due - message.queuedAt;
+        if (firstSent < 0) {
+            firstSent = sent;
+        }
+        lastSent = sent;
+        queue.pop_front();
+    }
+
+    result.ok = true;
+    result.stats = summarize(lateness, leadTotal, writeTotal, firstSent < 0 ? 0 : lastSent - firstSent);
+    return result;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "eventstream.h"
+
+/* Real-time playback of converted sequences, for auditioning them live. Events are sent as raw MIDI
+messages (no delta times, running status or file framing) to a byte sink at the moment they're due, so
+the sink can be a MIDI device node, a FIFO into a synth, a file or stdout. */
+
+struct PlaybackOptions {
+    double lookahead = 0.02;     // Seconds of events converted and queued ahead of the clock
+    double spin = 0.001;         // The last stretch before an event is busy-waited instead of slept
+};
+
+// Timing of a playback, all in seconds
+struct PlaybackStats {
+    size_t messages = 0;
+    double duration = 0;         // Wall clock, first to last message
+    double meanLateness = 0;     // Dispatch time minus due time
+    double medianLateness = 0;
+    double p99Lateness = 0;
+    double maxLateness = 0;
+    double jitter = 0;           // Standard deviation of the lateness
+    double meanLead = 0;         // How far ahead of their due time messages were queued
+    double meanWrite = 0;        // Time writing and flushing one message to the sink took
+    size_t lateMessages = 0;     // Sent more than 1ms late
+};
+
+struct PlaybackResult {
+    bool ok = false;
+    std::string failure;
+    PlaybackStats stats;
+};
+
+// Plays resolved tracks (ConversionResult::events) to `sink`, tempo changes apply as playback reaches them
+PlaybackResult playSequence(const std::vector<EventStream>& tracks, uint16_t ppqn, std::ostream& sink,
+                            const PlaybackOptions& options = PlaybackOptions());
@@ -0,0 +1,816 @@
+#include "sf2renderer.h"
+#include "workstealingpool.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <sstream>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define SF2_MIXER_SSE
+#endif
+
+/* SoundFont 2 renderer
+
+- AZ
+
+ */
+
+/*SoundFont Loading*/
+
+namespace {
+
+// Generator operators used by the renderer (SoundFont 2.04, 8.1.2)
+enum Generator : uint16_t {
+    GEN_START_OFFSET            = 0,
+    GEN_END_OFFSET              = 1,
+    GEN_LOOP_START_OFFSET       = 2,
+    GEN_LOOP_END_OFFSET         = 3,
+    GEN_START_COARSE_OFFSET     = 4,
+    GEN_END_COARSE_OFFSET       = 12,
+    GEN_PAN                     = 17,
+    GEN_DELAY_VOL_ENV           = 33,
+    GEN_ATTACK_VOL_ENV          = 34,
+    GEN_HOLD_VOL_ENV            = 35,
+    GEN_DECAY_VOL_ENV           = 36,
+    GEN_SUSTAIN_VOL_ENV         = 37,
+    GEN_RELEASE_VOL_ENV         = 38,
+    GEN_INSTRUMENT              = 41,
+    GEN_KEY_RANGE               = 43,
+    GEN_VELOCITY_RANGE          = 44,
+    GEN_LOOP_START_COARSE_OFFSET = 45,
+    GEN_INITIAL_ATTENUATION     = 48,
+    GEN_LOOP_END_COARSE_OFFSET  = 50,
+    GEN_COARSE_TUNE             = 51,
+    GEN_FINE_TUNE               = 52,
+    GEN_SAMPLE_ID               = 53,
+    GEN_SAMPLE_MODES            = 54,
+    GEN_SCALE_TUNING            = 56,
+    GEN_OVERRIDING_ROOT_KEY     = 58,
+    GEN_COUNT                   = 61
+};
+
+struct GeneratorSet {
+    std::array<int16_t, GEN_COUNT> values{};
+    std::array<bool, GEN_COUNT> set{};
+    uint8_t keyLow = 0, keyHigh = 127;
+    uint8_t velocityLow = 0, velocityHigh = 127;
+
+    void apply(uint16_t oper, const uint8_t* amount) {
+        if (oper == GEN_KEY_RANGE) {
+            keyLow = amount[0];
+            keyHigh = amount[1];
+        } else if (oper == GEN_VELOCITY_RANGE) {
+            velocityLow = amount[0];
+            velocityHigh = amount[1];
+        } else if (oper < GEN_COUNT) {
+            values[oper] = static_cast<int16_t>(amount[0] | (amount[1] << 8));
+            set[oper] = true;
+        }
+    }
+};
+
+// Chunk of the RIFF file, the pdta records are read straight out of these
+struct ChunkView {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+};
+
+uint16_t readLE16(const uint8_t* data) {
+    return static_cast<uint16_t>(data[0] | (data[1] << 8));
+}
+
+uint32_t readLE32(const uint8_t* data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+float timecentsToSeconds(int16_t timecents) {
+    return (timecents <= -12000) ? 0.0f : std::pow(2.0f, timecents / 1200.0f);
+}
+
+float centibelsToGain(int centibels) {
+    return std::pow(10.0f, -std::clamp(centibels, 0, 1440) / 200.0f);
+}
+
+// Calls found(id, chunk) for every chunk in [data, data + size), false if one runs past the end
+template <typename Found>
+bool forEachChunk(const uint8_t* data, size_t size, Found found) {
+    size_t offset = 0;
+    while (offset + 8 <= size) {
+        uint32_t chunkSize = readLE32(data + offset + 4);
+        if (chunkSize > size - offset - 8) {
+            return false;
+        }
+        found(std::string(reinterpret_cast<const char*>(data + offset), 4), ChunkView{data + offset + 8, chunkSize});
+        offset += 8 + chunkSize + (chunkSize & 1);
+    }
+    return true;
+}
+
+} // namespace
+
+bool SoundFont::load(const uint8_t* data, size_t size, std::string& failure) {
+    sampleData.clear();
+    presets.clear();
+
+    if (size < 12 || std::memcmp(data, "RIFF", 4) != 0 || std::memcmp(data + 8, "sfbk", 4) != 0) {
+        failure = "Not a SoundFont 2 file";
+        return false;
+    }
+
+    std::map<std::string, ChunkView> chunks;
+    bool ok = forEachChunk(data + 12, std::min<size_t>(size - 12, readLE32(data + 4) - 4), [&](const std::string& id, ChunkView list) {
+        if (id == "LIST" && list.size >= 4) {
+            forEachChunk(list.data + 4, list.size - 4, [&](const std::string& subId, ChunkView chunk) { chunks[subId] = chunk; });
+        }
+    });
+
+    // Record tables of the pdta list, each with its record size
+    const std::pair<const char*, size_t> tables[] = {
+        {"phdr", 38}, {"pbag", 4}, {"pgen", 4}, {"inst", 22}, {"ibag", 4}, {"igen", 4}, {"shdr", 46}};
+    for (const auto& table : tables) {
+        auto chunk = chunks.find(table.first);
+        if (!ok || chunk == chunks.end() || chunk->second.size < 2 * table.second) {
+            failure = std::string("SoundFont is missing its ") + table.first + " table";
+            return false;
+        }
+    }
+    if (chunks.find("smpl") == chunks.end()) {
+        failure = "SoundFont has no sample data";
+        return false;
+    }
+
+    // 16-bit little-endian samples, copied out so they're aligned
+    const ChunkView& smpl = chunks["smpl"];
+    sampleData.resize(smpl.size / 2);
+    for (size_t i = 0; i < sampleData.size(); i++) {
+        sampleData[i] = static_cast<int16_t>(readLE16(smpl.data + 2 * i));
+    }
+
+    auto records = [&](const char* id, size_t recordSize) { return chunks[id].size / recordSize; };
+    const ChunkView& phdr = chunks["phdr"];
+    const ChunkView& pbag = chunks["pbag"];
+    const ChunkView& pgen = chunks["pgen"];
+    const ChunkView& inst = chunks["inst"];
+    const ChunkView& ibag = chunks["ibag"];
+    const ChunkView& igen = chunks["igen"];
+    const ChunkView& shdr = chunks["shdr"];
+    size_t presetCount = records("phdr", 38) - 1; // The last record of every table is a terminator
+    size_t instrumentCount = records("inst", 22) - 1;
+    size_t sampleCount = records("shdr", 46) - 1;
+    size_t pbagCount = records("pbag", 4);
+    size_t ibagCount = records("ibag", 4);
+    size_t pgenCount = records("pgen", 4);
+    size_t igenCount = records("igen", 4);
+
+    // Generators of bag `bag` (and the bag after it for the end) applied over `generators`, false if it's out of range
+    auto readZone = [](const ChunkView& bags, size_t bagCount, const ChunkView& gens, size_t genCount, size_t bag, GeneratorSet& generators) {
+        if (bag + 1 >= bagCount) {
+            return false;
+        }
+        size_t first = readLE16(bags.data + bag * 4);
+        size_t last = std::min<size_t>(readLE16(bags.data + (bag + 1) * 4), genCount);
+        for (size_t gen = first; gen < last; gen++) {
+            generators.apply(readLE16(gens.data + gen * 4), gens.data + gen * 4 + 2);
+        }
+        return true;
+    };
+
+    // Zones are [bag of this record, bag of the next record), a first zone without the terminal generator is global
+    auto zoneRange = [](const ChunkView& headers, size_t recordSize, size_t bagOffset, size_t index) {
+        return std::make_pair<size_t, size_t>(readLE16(headers.data + index * recordSize + bagOffset),
+                                              readLE16(headers.data + (index + 1) * recordSize + bagOffset));
+    };
+
+    for (size_t p = 0; p < presetCount; p++) {
+        const uint8_t* header = phdr.data + p * 38;
+        Preset preset;
+        preset.name = std::string(reinterpret_cast<const char*>(header), strnlen(reinterpret_cast<const char*>(header), 20));
+        preset.program = readLE16(header + 20);
+        preset.bank = readLE16(header + 22);
+
+        auto presetZones = zoneRange(phdr, 38, 24, p);
+        GeneratorSet presetGlobal;
+        for (size_t zone = presetZones.first; zone < presetZones.second; zone++) {
+            GeneratorSet presetZone = presetGlobal;
+            if (!readZone(pbag, pbagCount, pgen, pgenCount, zone, presetZone)) {
+                break;
+            }
+            if (!presetZone.set[GEN_INSTRUMENT]) {
+                if (zone == presetZones.first) {
+                    presetGlobal = presetZone;
+                }
+                continue;
+            }
+            size_t instrument = static_cast<uint16_t>(presetZone.values[GEN_INSTRUMENT]);
+            if (instrument >= instrumentCount) {
+                continue;
+            }
+
+            // Instrument defaults that aren't zero
+            GeneratorSet instrumentGlobal;
+            for (Generator envelope : {GEN_DELAY_VOL_ENV, GEN_ATTACK_VOL_ENV, GEN_HOLD_VOL_ENV, GEN_DECAY_VOL_ENV, GEN_RELEASE_VOL_ENV}) {
+                instrumentGlobal.values[envelope] = -12000;
+            }
+            instrumentGlobal.values[GEN_SCALE_TUNING] = 100;
+            instrumentGlobal.values[GEN_OVERRIDING_ROOT_KEY] = -1;
+
+            auto instrumentZones = zoneRange(inst, 22, 20, instrument);
+            for (size_t izone = instrumentZones.first; izone < instrumentZones.second; izone++) {
+                GeneratorSet instrumentZone = instrumentGlobal;
+                if (!readZone(ibag, ibagCount, igen, igenCount, izone, instrumentZone)) {
+                    break;
+                }
+                if (!instrumentZone.set[GEN_SAMPLE_ID]) {
+                    if (izone == instrumentZones.first) {
+                        instrumentGlobal = instrumentZone;
+                    }
+                    continue;
+                }
+                size_t sample = static_cast<uint16_t>(instrumentZone.values[GEN_SAMPLE_ID]);
+                if (sample >= sampleCount) {
+                    continue;
+                }
+                const uint8_t* sampleHeader = shdr.data + sample * 46;
+                if (readLE16(sampleHeader + 44) & 0x8000) {
+                    continue; // ROM samples aren't in the file
+                }
+
+                Region region;
+                region.keyLow = std::max(presetZone.keyLow, instrumentZone.keyLow);
+                region.keyHigh = std::min(presetZone.keyHigh, instrumentZone.keyHigh);
+                region.velocityLow = std::max(presetZone.velocityLow, instrumentZone.velocityLow);
+                region.velocityHigh = std::min(presetZone.velocityHigh, instrumentZone.velocityHigh);
+                if (region.keyLow > region.keyHigh || region.velocityLow > region.velocityHigh) {
+                    continue;
+                }
+
+                // Preset level generators add to the instrument's, except the sample addressing ones
+                auto value = [&](Generator gen) { return instrumentZone.values[gen] + presetZone.values[gen]; };
+                auto address = [&](Generator fine, Generator coarse) {
+                    return static_cast<int64_t>(instrumentZone.values[fine]) + 32768 * static_cast<int64_t>(instrumentZone.values[coarse]);
+                };
+                int64_t total = static_cast<int64_t>(sampleData.size());
+                auto clampAddress = [&](int64_t position) { return static_cast<uint32_t>(std::clamp<int64_t>(position, 0, total - 1)); };
+                region.start = clampAddress(readLE32(sampleHeader + 20) + address(GEN_START_OFFSET, GEN_START_COARSE_OFFSET));
+                region.end = clampAddress(readLE32(sampleHeader + 24) + address(GEN_END_OFFSET, GEN_END_COARSE_OFFSET));
+                region.loopStart = clampAddress(readLE32(sampleHeader + 28) + address(GEN_LOOP_START_OFFSET, GEN_LOOP_START_COARSE_OFFSET));
+                region.loopEnd = clampAddress(readLE32(sampleHeader + 32) + address(GEN_LOOP_END_OFFSET, GEN_LOOP_END_COARSE_OFFSET));
+                if (region.start >= region.end) {
+                    continue;
+                }
+                int sampleModes = instrumentZone.values[GEN_SAMPLE_MODES] & 3;
+                region.loop = (sampleModes == 1 || sampleModes == 3) && region.loopStart >= region.start &&
+                              region.loopEnd <= region.end && region.loopStart + 1 < region.loopEnd;
+                region.loopUntilRelease = sampleModes == 3;
+
+                region.sampleRate = std::max<uint32_t>(1, readLE32(sampleHeader + 36));
+                uint8_t originalPitch = sampleHeader[40];
+                int16_t rootKey = instrumentZone.values[GEN_OVERRIDING_ROOT_KEY];
+                region.rootKey = (rootKey >= 0 && rootKey <= 127) ? rootKey : (originalPitch <= 127 ? originalPitch : 60);
+                region.tuneCents = value(GEN_COARSE_TUNE) * 100.0f + value(GEN_FINE_TUNE) + static_cast<int8_t>(sampleHeader[41]);
+                region.scaleTuning = static_cast<float>(value(GEN_SCALE_TUNING));
+                region.gain = centibelsToGain(value(GEN_INITIAL_ATTENUATION));
+                region.pan = std::clamp(value(GEN_PAN), -500, 500) / 1000.0f;
+
+                region.delay = timecentsToSeconds(static_cast<int16_t>(std::max(value(GEN_DELAY_VOL_ENV), -32768)));
+                region.attack = timecentsToSeconds(static_cast<int16_t>(std::max(value(GEN_ATTACK_VOL_ENV), -32768)));
+                region.hold = timecentsToSeconds(static_cast<int16_t>(std::max(value(GEN_HOLD_VOL_ENV), -32768)));
+                region.decay = timecentsToSeconds(static_cast<int16_t>(std::max(value(GEN_DECAY_VOL_ENV), -32768)));
+                region.release = timecentsToSeconds(static_cast<int16_t>(std::max(value(GEN_RELEASE_VOL_ENV), -32768)));
+                region.sustain = centibelsToGain(value(GEN_SUSTAIN_VOL_ENV));
+
+                preset.regions.push_back(region);
+            }
+        }
+        presets.push_back(std::move(preset));
+    }
+
+    std::stable_sort(presets.begin(), presets.end(), [](const Preset& a, const Preset& b) {
+        return a.bank != b.bank ? a.bank < b.bank : a.program < b.program;
+    });
+    return true;
+}
+
+const SoundFont::Preset* SoundFont::findPreset(uint16_t bank, uint16_t program) const {
+    auto find = [&](uint16_t wantedBank) -> const Preset* {
+        auto preset = std::lower_bound(presets.begin(), presets.end(), std::make_pair(wantedBank, program),
+                                       [](const Preset& a, const std::pair<uint16_t, uint16_t>& b) {
+                                           return a.bank != b.first ? a.bank < b.first : a.program < b.second;
+                                       });
+        return (preset != presets.end() && preset->bank == wantedBank && preset->program == program) ? &*preset : nullptr;
+    };
+
+    if (const Preset* preset = find(bank)) {
+        return preset;
+    }
+    if (const Preset* preset = find(0)) {
+        return preset;
+    }
+    for (const auto& preset : presets) {
+        if (preset.program == program) {
+            return &preset;
+        }
+    }
+    return nullptr;
+}
+
+/*Voice Mixer*/
+
+namespace {
+
+const size_t BLOCK_FRAMES = 64;     // Envelopes, pitch and gains are updated once per block
+const size_t CHUNK_FRAMES = 16384;  // Frames every channel renders before the mix is written out
+const size_t MAX_VOICES = 64;       // Per channel, the quietest released voice is dropped beyond it
+const float SILENCE = 1e-4f;        // -80dB, a releasing voice ends below it
+
+/* Adds a mono block to interleaved stereo with per-frame linear gain ramps, so gain changes (envelope,
+volume, pan) don't click. Four frames per step with SSE, the interleave is two unpacks. */
+void mixVoice(float* out, const float* mono, size_t frames, float left, float leftStep, float right, float rightStep) {
+    size_t i = 0;
+#ifdef SF2_MIXER_SSE
+    __m128 leftGains = _mm_setr_ps(left, left + leftStep, left + 2 * leftStep, left + 3 * leftStep);
+    __m128 rightGains = _mm_setr_ps(right, right + rightStep, right + 2 * rightStep, right + 3 * rightStep);
+    __m128 leftStep4 = _mm_set1_ps(4 * leftStep);
+    __m128 rightStep4 = _mm_set1_ps(4 * rightStep);
+    for (; i + 4 <= frames; i += 4) {
+        __m128 samples = _mm_loadu_ps(mono + i);
+        __m128 leftSamples = _mm_mul_ps(samples, leftGains);
+        __m128 rightSamples = _mm_mul_ps(samples, rightGains);
+        float* frame = out + 2 * i;
+        _mm_storeu_ps(frame, _mm_add_ps(_mm_loadu_ps(frame), _mm_unpacklo_ps(leftSamples, rightSamples)));
+        _mm_storeu_ps(frame + 4, _mm_add_ps(_mm_loadu_ps(frame + 4), _mm_unpackhi_ps(leftSamples, rightSamples)));
+        leftGains = _mm_add_ps(leftGains, leftStep4);
+        rightGains = _mm_add_ps(rightGains, rightStep4);
+    }
+    left += i * leftStep;
+    right += i * rightStep;
+#endif
+    for (; i < frames; i++) {
+        out[2 * i] += mono[i] * left;
+        out[2 * i + 1] += mono[i] * right;
+        left += leftStep;
+        right += rightStep;
+    }
+}
+
+enum EnvelopeStage : uint8_t {
+    ENV_DELAY,
+    ENV_ATTACK,
+    ENV_HOLD,
+    ENV_DECAY,
+    ENV_SUSTAIN,
+    ENV_RELEASE,
+    ENV_DONE
+};
+
+struct Voice {
+    const SoundFont::Region* region = nullptr;
+    uint8_t note = 0;
+    double position = 0;        // In sample frames
+    double baseStep = 0;        // Sample frames per output frame without pitch bend
+    float velocityGain = 1;
+    float leftGain = 0, rightGain = 0; // Gains the last block ended on
+    bool released = false;
+    bool finished = false;
+
+    EnvelopeStage stage = ENV_DELAY;
+    float stageTime = 0;
+    float level = 0;
+    float releaseLevel = 0;
+
+    // Moves the volume envelope `seconds` forward, attack is linear, decay and release fall 96dB over their time
+    void advanceEnvelope(float seconds) {
+        const SoundFont::Region& r = *region;
+        while (seconds > 0 && stage != ENV_DONE) {
+            float length = 0;
+            switch (stage) {
+                case ENV_DELAY: length = r.delay; break;
+                case ENV_ATTACK: length = r.attack; break;
+                case ENV_HOLD: length = r.hold; break;
+                case ENV_DECAY: length = r.decay; break;
+                case ENV_SUSTAIN: stageTime += seconds; seconds = 0; continue;
+                case ENV_RELEASE: length = r.release; break;
+                case ENV_DONE: break;
+            }
+
+            float step = std::min(seconds, std::max(0.0f, length - stageTime));
+            stageTime += step;
+            seconds -= step;
+            bool stageOver = stageTime >= length;
+
+            switch (stage) {
+                case ENV_DELAY:
+                    level = 0;
+                    break;
+                case ENV_ATTACK:
+                    level = stageOver ? 1.0f : stageTime / length;
+                    break;
+                case ENV_HOLD:
+                    level = 1;
+                    break;
+                case ENV_DECAY:
+                    level = stageOver ? r.sustain : std::max(r.sustain, std::pow(10.0f, -4.8f * stageTime / length));
+                    stageOver = stageOver || level <= r.sustain;
+                    break;
+                case ENV_RELEASE:
+                    level = stageOver ? 0.0f : releaseLevel * std::pow(10.0f, -4.8f * stageTime / length);
+                    stageOver = stageOver || level < SILENCE;
+                    break;
+                default:
+                    break;
+            }
+
+            if (stageOver) {
+                stage = static_cast<EnvelopeStage>(stage + 1);
+                stageTime = 0;
+                if (stage == ENV_SUSTAIN && r.sustain < SILENCE) {
+                    stage = ENV_DONE;
+                }
+            }
+        }
+        if (stage == ENV_DONE) {
+            level = 0;
+            finished = true;
+        }
+    }
+
+    void release() {
+        if (!released) {
+            released = true;
+            releaseLevel = (stage == ENV_DELAY) ? 0.0f : level;
+            stage = ENV_RELEASE;
+            stageTime = 0;
+        }
+    }
+
+    // Fills `out` with the next frames of the sample at `step` frames per output frame, linear interpolation
+    void readSample(const int16_t* samples, float* out, size_t frames, double step) {
+        const SoundFont::Region& r = *region;
+        bool looping = r.loop && !(r.loopUntilRelease && released);
+        double loopLength = r.loopEnd - r.loopStart;
+
+        for (size_t i = 0; i < frames; i++) {
+            if (looping) {
+                while (position >= r.loopEnd) {
+                    position -= loopLength;
+                }
+            } else if (position >= r.end) {
+                std::fill(out + i, out + frames, 0.0f);
+                finished = true;
+                return;
+            }
+            size_t index = static_cast<size_t>(position);
+            float fraction = static_cast<float>(position - index);
+            float a = samples[index];
+            float b = samples[index + 1]; // end is at most the last sample, sample data is padded past every sample
+            out[i] = (a + (b - a) * fraction) * (1.0f / 32768.0f);
+            position += step;
+        }
+    }
+};
+
+struct ChannelEvent {
+    uint64_t frame;
+    uint8_t type;
+    uint8_t data2;
+    uint32_t data1;
+};
+
+// One MIDI channel's events and voices, channels don't share state so each renders on its own
+class ChannelRenderer {
+public:
+    std::vector<ChannelEvent> events;
+    std::vector<float> buffer; // Interleaved stereo, one chunk
+
+    ChannelRenderer(const SoundFont& soundFont, uint32_t sampleRate) : soundFont(soundFont), sampleRate(sampleRate) {}
+
+    bool active() const {
+        return nextEvent < events.size() || !voices.empty();
+    }
+
+    // Renders frames [start, start + frames) into buffer
+    void render(uint64_t start, size_t frames) {
+        buffer.assign(2 * frames, 0.0f);
+        size_t done = 0;
+        while (done < frames) {
+            uint64_t now = start + done;
+            while (nextEvent < events.size() && events[nextEvent].frame <= now) {
+                handleEvent(events[nextEvent++]);
+            }
+
+            size_t count = std::min(frames - done, BLOCK_FRAMES);
+            if (nextEvent < events.size()) {
+                count = std::min<uint64_t>(count, events[nextEvent].frame - now); // Split the block at the next event
+            }
+            renderBlock(buffer.data() + 2 * done, count);
+            done += count;
+        }
+    }
+
+    std::vector<std::pair<uint16_t, uint16_t>> missingPresets; // Bank, program
+
+private:
+    const SoundFont& soundFont;
+    uint32_t sampleRate;
+    size_t nextEvent = 0;
+    std::vector<Voice> voices;
+    const SoundFont::Preset* preset = nullptr;
+
+    float volume = 100 / 127.0f; // General MIDI defaults
+    float pan = 0;
+    float bendSemitones = 0;
+    std::array<float, BLOCK_FRAMES> mono{};
+
+    void handleEvent(const ChannelEvent& event) {
+        switch (event.type) {
+            case EV_NOTE_ON:
+                if (event.data2 == 0) {
+                    noteOff(static_cast<uint8_t>(event.data1));
+                } else {
+                    noteOn(static_cast<uint8_t>(event.data1), event.data2);
+                }
+                break;
+            case EV_NOTE_OFF:
+                noteOff(static_cast<uint8_t>(event.data1));
+                break;
+            case EV_PROGRAM: {
+                uint16_t bank = FIRST_BANK + event.data1 / 128;
+                uint16_t program = event.data1 % 128;
+                preset = soundFont.findPreset(bank, program);
+                if (preset == nullptr && std::find(missingPresets.begin(), missingPresets.end(), std::make_pair(bank, program)) == missingPresets.end()) {
+                    missingPresets.emplace_back(bank, program);
+                }
+                break;
+            }
+            case EV_VOLUME:
+                volume = std::min<uint32_t>(event.data1, 127) / 127.0f;
+                break;
+            case EV_PAN:
+                pan = (static_cast<int>(std::min<uint32_t>(event.data1, 127)) - 64) / 128.0f;
+                break;
+            case EV_PITCH_BEND:
+                bendSemitones = (static_cast<int>(event.data1 & 0x3FFF) - 8192) / 8192.0f * PITCH_BEND_RANGE;
+                break;
+            case EV_ALL_NOTES_OFF:
+                for (auto& voice : voices) {
+                    voice.release();
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    void noteOn(uint8_t note, uint8_t velocity) {
+        if (preset == nullptr) {
+            return;
+        }
+        for (const auto& region : preset->regions) {
+            if (note < region.keyLow || note > region.keyHigh || velocity < region.velocityLow || velocity > region.velocityHigh) {
+                continue;
+            }
+            if (voices.size() >= MAX_VOICES) {
+                dropQuietestVoice();
+            }
+
+            Voice voice;
+            voice.region = &region;
+            voice.note = note;
+            voice.position = region.start;
+            float cents = (note - region.rootKey) * region.scaleTuning + region.tuneCents;
+            voice.baseStep = std::pow(2.0, cents / 1200.0) * region.sampleRate / sampleRate;
+            float velocityScale = velocity / 127.0f;
+            voice.velocityGain = region.gain * velocityScale * velocityScale;
+            voice.advanceEnvelope(0);
+            voices.push_back(voice);
+        }
+    }
+
+    void noteOff(uint8_t note) {
+        for (auto& voice : voices) {
+            if (voice.note == note && !voice.released) {
+                voice.release();
+            }
+        }
+    }
+
+    void dropQuietestVoice() {
+        auto quietest = std::min_element(voices.begin(), voices.end(), [](const Voice& a, const Voice& b) {
+            if (a.released != b.released) {
+                return a.released; // Released voices go first
+            }
+            return a.level < b.level;
+        });
+        voices.erase(quietest);
+    }
+
+    void renderBlock(float* out, size_t frames) {
+        if (frames == 0) {
+            return;
+        }
+        const int16_t* samples = soundFont.samples().data();
+        double bend = std::pow(2.0, bendSemitones / 12.0);
+        float seconds = static_cast<float>(frames) / sampleRate;
+        float channelGain = volume * volume;
+
+        for (auto& voice : voices) {
+            voice.advanceEnvelope(seconds);
+
+            // Constant power pan, the region's pan plus the channel's
+            float voicePan = std::clamp(voice.region->pan + pan, -0.5f, 0.5f);
+            float angle = (voicePan + 0.5f) * 1.5707963f;
+            float gain = voice.level * voice.velocityGain * channelGain;
+            float left = gain * std::cos(angle);
+            float right = gain * std::sin(angle);
+
+            voice.readSample(samples, mono.data(), frames, voice.baseStep * bend);
+            mixVoice(out, mono.data(), frames, voice.leftGain, (left - voice.leftGain) / frames,
+                     voice.rightGain, (right - voice.rightGain) / frames);
+            voice.leftGain = left;
+            voice.rightGain = right;
+        }
+
+        voices.erase(std::remove_if(voices.begin(), voices.end(), [](const Voice& voice) { return voice.finished; }), voices.end());
+    }
+};
+
+// Tick to output frame, through every tempo change of every track
+class TempoMap {
+public:
+    TempoMap(const std::vector<EventStream>& tracks, uint16_t ppqn, uint32_t sampleRate) {
+        std::vector<std::pair<uint32_t, uint32_t>> tempos; // Tick, microseconds per quarter note
+        for (const auto& track : tracks) {
+            for (size_t i = 0; i < track.size(); i++) {
+                if (track.types[i] == EV_TEMPO && track.data1[i] > 0) {
+                    tempos.emplace_back(track.ticks[i], track.data1[i]);
+                }
+            }
+        }
+        std::stable_sort(tempos.begin(), tempos.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+        double ticksPerQuarter = std::max<uint16_t>(1, ppqn);
+        segments.push_back({0, 0, 500000.0 / 1e6 / ticksPerQuarter * sampleRate}); // 120 BPM until the first tempo
+        for (const auto& tempo : tempos) {
+            const Segment& last = segments.back();
+            double frame = last.frame + (tempo.first - last.tick) * last.framesPerTick;
+            segments.push_back({tempo.first, frame, tempo.second / 1e6 / ticksPerQuarter * sampleRate});
+        }
+    }
+
+    uint64_t frameAt(uint32_t tick) const {
+        auto segment = std::upper_bound(segments.begin(), segments.end(), tick,
+                                        [](uint32_t value, const Segment& s) { return value < s.tick; }) - 1;
+        return static_cast<uint64_t>(segment->frame + (tick - segment->tick) * segment->framesPerTick);
+    }
+
+private:
+    struct Segment {
+        uint32_t tick;
+        double frame;
+        double framesPerTick;
+    };
+    std::vector<Segment> segments;
+};
+
+void writeLE(std::ostream& out, uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        out.put(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+}
+
+void writeWAVHeader(std::ostream& out, uint32_t sampleRate, uint64_t frames) {
+    uint32_t dataBytes = static_cast<uint32_t>(std::min<uint64_t>(frames * 4, 0xFFFFFFFFull - 36));
+    out.write("RIFF", 4);
+    writeLE(out, 36 + dataBytes, 4);
+    out.write("WAVEfmt ", 8);
+    writeLE(out, 16, 4);
+    writeLE(out, 1, 2);              // PCM
+    writeLE(out, 2, 2);              // Stereo
+    writeLE(out, sampleRate, 4);
+    writeLE(out, sampleRate * 4, 4); // Bytes per second
+    writeLE(out, 4, 2);              // Bytes per frame
+    writeLE(out, 16, 2);             // Bits per sample
+    out.write("data", 4);
+    writeLE(out, dataBytes, 4);
+}
+
+} // namespace
+
+/*Render*/
+
+/* Channels are independent in MIDI, so the tracks' events are regrouped per channel and every channel
+renders a chunk into its own buffer (concurrently on the pool), then the chunk is mixed down and written.
+Memory stays at one chunk per channel however long the sequence is. */
+RenderResult renderWAV(const std::vector<EventStream>& tracks, uint16_t ppqn, const SoundFont& soundFont,
+                       const RenderOptions& options, std::ostream& wavOut) {
+    RenderResult result;
+    auto start = std::chrono::steady_clock::now();
+    uint32_t sampleRate = std::max<uint32_t>(8000, options.sampleRate);
+    TempoMap tempoMap(tracks, ppqn, sampleRate);
+
+    // Per channel in tick order, events at the same tick keep their track order
+    std::vector<std::unique_ptr<ChannelRenderer>> channels;
+    std::array<int, 256> channelIndex;
+    channelIndex.fill(-1);
+    uint64_t lastEventFrame = 0;
+    for (const auto& track : tracks) {
+        for (size_t i = 0; i < track.size(); i++) {
+            uint8_t type = track.types[i];
+            if (type == EV_TEMPO || type == EV_MARKER || type == EV_REVERB) {
+                continue;
+            }
+            int& index = channelIndex[track.channels[i]];
+            if (index < 0) {
+                index = static_cast<int>(channels.size());
+                channels.push_back(std::make_unique<ChannelRenderer>(soundFont, sampleRate));
+            }
+            uint64_t frame = tempoMap.frameAt(track.ticks[i]);
+            channels[index]->events.push_back({frame, type, track.data2[i], track.data1[i]});
+            lastEventFrame = std::max(lastEventFrame, frame);
+        }
+    }
+    for (auto& channel : channels) {
+        std::stable_sort(channel->events.begin(), channel->events.end(),
+                         [](const ChannelEvent& a, const ChannelEvent& b) { return a.frame < b.frame; });
+    }
+
+    // Sizes are patched in at the end, the length isn't known until the last voice dies out
+    std::streampos headerPosition = wavOut.tellp();
+    writeWAVHeader(wavOut, sampleRate, 0);
+
+    uint64_t tailLimit = lastEventFrame + 30ull * sampleRate; // Cuts off anything that never releases
+    std::vector<float> mix(2 * CHUNK_FRAMES);
+    std::vector<char> pcm(4 * CHUNK_FRAMES);
+    uint64_t frame = 0;
+
+    while (frame < tailLimit) {
+        bool anyActive = std::any_of(channels.begin(), channels.end(), [](const auto& channel) { return channel->active(); });
+        if (!anyActive && frame > lastEventFrame) {
+            break;
+        }
+        size_t frames = static_cast<size_t>(std::min<uint64_t>(CHUNK_FRAMES, tailLimit - frame));
+
+        if (options.pool != nullptr && channels.size() > 1) {
+            std::atomic<size_t> remaining{channels.size()};
+            for (auto& channel : channels) {
+                ChannelRenderer* renderer = channel.get();
+                options.pool->submit([renderer, frame, frames, &remaining] {
+                    renderer->render(frame, frames);
+                    remaining--;
+                });
+            }
+            options.pool->waitFor(remaining);
+        } else {
+            for (auto& channel : channels) {
+                channel->render(frame, frames);
+            }
+        }
+
+        std::fill(mix.begin(), mix.begin() + 2 * frames, 0.0f);
+        for (const auto& channel : channels) {
+            const float* buffer = channel->buffer.data();
+            for (size_t i = 0; i < 2 * frames; i++) {
+                mix[i] += buffer[i];
+            }
+        }
+        for (size_t i = 0; i < 2 * frames; i++) {
+            float value = std::clamp(mix[i] * options.gain, -1.0f, 1.0f);
+            int16_t sample = static_cast<int16_t>(std::lrint(value * 32767.0f));
+            pcm[2 * i] = static_cast<char>(sample & 0xFF);
+            pcm[2 * i + 1] = static_cast<char>((sample >> 8) & 0xFF);
+        }
+        wavOut.write(pcm.data(), 4 * frames);
+        frame += frames;
+    }
+
+    std::streampos end = wavOut.tellp();
+    wavOut.seekp(headerPosition);
+    writeWAVHeader(wavOut, sampleRate, frame);
+    wavOut.seekp(end);
+
+    for (const auto& channel : channels) {
+        for (const auto& missing : channel->missingPresets) {
+            std::ostringstream line;
+            line << "SoundFont has no preset for bank " << missing.first << ", program " << missing.second << std::endl;
+            if (result.diagnostics.find(line.str()) == std::string::npos) {
+                result.diagnostics += line.str();
+            }
+        }
+    }
+
+    if (!wavOut) {
+        result.failure = "Failed to write the WAV file";
+        return result;
+    }
+    result.ok = true;
+    result.frames = frame;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "eventstream.h"
+
+class WorkStealingPool;
+
+/* Renders converted sequences to audio with a SoundFont 2 bank, instead of writing MIDI and running it
+through an external player. Plays what a General MIDI player would with the converter's output: note
+on/off, program (with the FIRST_BANK bank offset), volume, pan and pitch bend over PITCH_BEND_RANGE.
+Reverb sends, modulators and filters aren't rendered. */
+
+// A loaded SoundFont, presets are flattened into regions with the preset and instrument generators applied
+class SoundFont {
+public:
+    struct Region {
+        uint8_t keyLow = 0, keyHigh = 127;
+        uint8_t velocityLow = 0, velocityHigh = 127;
+        uint32_t start = 0, end = 0;         // Sample frames, in samples
+        uint32_t loopStart = 0, loopEnd = 0;
+        bool loop = false;
+        bool loopUntilRelease = false;       // Plays on to the end once the note is released
+        uint32_t sampleRate = 44100;
+        int rootKey = 60;
+        float tuneCents = 0;                 // Coarse and fine tune plus the sample's pitch correction
+        float scaleTuning = 100;             // Cents per key
+        float gain = 1;                      // Initial attenuation as a factor
+        float pan = 0;                       // -0.5 (left) to 0.5 (right)
+        float delay = 0, attack = 0, hold = 0, decay = 0, release = 0; // Volume envelope, seconds
+        float sustain = 1;                   // Volume envelope sustain level as a factor
+    };
+
+    struct Preset {
+        uint16_t bank = 0;
+        uint16_t program = 0;
+        std::string name;
+        std::vector<Region> regions;
+    };
+
+    bool load(const uint8_t* data, size_t size, std::string& failure);
+
+    // Preset for a bank/program, falls back to bank 0 then any bank, nullptr when the program isn't there at all
+    const Preset* findPreset(uint16_t bank, uint16_t program) const;
+
+    const std::vector<int16_t>& samples() const {
+        return sampleData;
+    }
+
+private:
+    std::vector<int16_t> sampleData;
+    std::vector<Preset> presets;
+};
+
+struct RenderOptions {
+    uint32_t sampleRate = 44100;
+    float gain = 0.5f;                   // Master gain, the mix is clipped to 16 bits after it
+    WorkStealingPool* pool = nullptr;    // Render the channels concurrently on this pool when set
+};
+
+struct RenderResult {
+    bool ok = false;
+    std::string failure;
+    std::string diagnostics;   // Programs the SoundFont doesn't have, one per line
+    uint64_t frames = 0;       // Length of the audio in sample frames
+    double seconds = 0;        // Time the render took
+};
+
+// Renders resolved tracks (ConversionResult::events) as a 16-bit stereo WAV file, `wavOut` has to be seekable
+RenderResult renderWAV(const std::vector<EventStream>& tracks, uint16_t ppqn, const SoundFont& soundFont,
+                       const RenderOptions& options, std::ostream& wavOut);
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+/*Thread Pool*/
+
+// Work-stealing pool: every worker owns a deque, pops its own tasks from the back
+// and steals from the front of the other deques once its own runs dry.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(unsigned threadCount) : queues(threadCount == 0 ? 1 : threadCount) {
+        for (unsigned i = 0; i < queues.size(); i++) {
+            workers.emplace_back([this, i] { workerLoop(i); });
+        }
+    }
+
+    ~WorkStealingPool() {
+        wait();
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    void submit(std::function<void()> task) {
+        // Tasks submitted from a worker stay on its own deque, others are spread round robin
+        size_t target = (currentPool == this) ? currentQueue : (nextQueue++ % queues.size());
+        pending++;
+        bool waiting;
+        {
+            // Counted before it's pushed, a worker could otherwise take it and count it down first
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            queued++;
+            waiting = waiters > 0;
+        }
+        {
+            std::lock_guard<std::mutex> lock(queues[target].mutex);
+            queues[target].tasks.push_back(std::move(task));
+        }
+        wake.notify_one();
+        if (waiting) {
+            progress.notify_all();
+        }
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(wakeMutex);
+        idle.wait(lock, [this] { return pending == 0; });
+    }
+
+    // Blocks until `remaining` drops to zero, running queued tasks meanwhile so a worker
+    // waiting on its own sub-tasks (tracks of a file) can't starve the pool. With nothing
+    // to run it sleeps until a task finishes (tasks are what count `remaining` down) or is submitted
+    void waitFor(const std::atomic<size_t>& remaining) {
+        size_t self = (currentPool == this) ? currentQueue : 0;
+        while (remaining > 0) {
+            if (runPendingTask(self)) {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            waiters++;
+            progress.wait(lock, [this, &remaining] { return remaining == 0 || queued > 0; });
+            waiters--;
+        }
+    }
+
+    size_t threadCount() const {
+        return queues.size();
+    }
+
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<WorkQueue> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> nextQueue{0};
+    std::atomic<size_t> pending{0}; // Submitted but not yet finished
+
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::condition_variable progress; // A task finished or was submitted, for waitFor
+    size_t queued = 0; // Sitting in a deque, guarded by wakeMutex
+    size_t waiters = 0; // Threads asleep in waitFor, guarded by wakeMutex
+    bool stopping = false;
+
+    static inline thread_local WorkStealingPool* currentPool = nullptr;
+    static inline thread_local size_t currentQueue = 0;
+
+    bool takeTask(size_t self, std::function<void()>& task) {
+        // Own deque first (LIFO, still cache warm), then steal the oldest task of another worker
+        for (size_t i = 0; i < queues.size(); i++) {
+            WorkQueue& queue = queues[(self + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) {
+                continue;
+            }
+            if (i == 0) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            } else {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void workerLoop(size_t self) {
+        currentPool = this;
+        currentQueue = self;
+
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(wakeMutex);
+                wake.wait(lock, [this] { return queued > 0 || stopping; });
+                if (queued == 0 && stopping) {
+                    return;
+                }
+            }
+
+            runPendingTask(self); // False if another worker got there first
+        }
+    }
+
+    bool runPendingTask(size_t self) {
+        std::function<void()> task;
+        if (!takeTask(self, task)) {
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            queued--;
+        }
+
+        task();
+
+        bool finished = --pending == 0;
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        if (finished) {
+            idle.notify_all();
+        }
+        if (waiters > 0) {
+            progress.notify_all();
+        }
+        return true;
+    }
+};